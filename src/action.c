@@ -17,25 +17,75 @@
 
 #include "consolation.h"
 
-static double xx=1, yy=1, x0=-1, y0=-1, x1=-1, y1=-1;
-static int mode = 0;
-static enum current_button button = BUTTON_RELEASED;
+/* The pointer and selection state lives in struct seat: each seat has
+   its own pointer, and they all share the console selection. */
 
 void
-set_pointer(double x, double y)
+action_init(struct seat *s)
 {
-  xx = x+1; yy = y+1;
-  if (xx < 1) xx = 1; else if (xx > screen_width)  xx = screen_width;
-  if (yy < 1) yy = 1; else if (yy > screen_height) yy = screen_height;
+  s->xx = s->yy = 1;
+  s->x0 = s->y0 = s->x1 = s->y1 = -1;
+  s->mode = 0;
+  s->smart = 0;
+  s->button = BUTTON_RELEASED;
+  s->scroll_rest = 0;
+  s->report_x = s->report_y = 0;
+  s->report_pressed = BUTTON_LEFT;
+}
+
+static void
+report(struct seat *s)
+{
+  s->report_x = (int)s->xx;
+  s->report_y = (int)s->yy;
+  report_pointer(s);
+}
+
+/* Motion is reported at most once per render, and only when the pointer
+   moved to another cell. */
+static void
+report_moved(struct seat *s)
+{
+  if (mouse_encoding == MOUSE_ENCODING_KERNEL
+      || mouse_reporting != MOUSE_REPORTING_X11
+      || mouse_motion == MOUSE_MOTION_NONE
+      || (mouse_motion == MOUSE_MOTION_DRAG && s->button == BUTTON_RELEASED))
+    return;
+  if ((int)s->xx == s->report_x && (int)s->yy == s->report_y)
+    return;
+  s->report_x = (int)s->xx;
+  s->report_y = (int)s->yy;
+  report_motion(s);
+}
+
+static void
+clamp_pointer(struct seat *s)
+{
+  if (s->xx < 1) s->xx = 1;
+  else if (s->xx > screen_width)  s->xx = screen_width;
+  if (s->yy < 1) s->yy = 1;
+  else if (s->yy > screen_height) s->yy = screen_height;
+}
+
+void
+set_pointer(struct seat *s, double x, double y)
+{
+  s->xx = x+1; s->yy = y+1;
+  clamp_pointer(s);
   if (mouse_reporting != MOUSE_REPORTING_OFF)
   {
-    x0 = -1; y0 = -1;
-    mode = 0;
+    s->x0 = -1; s->y0 = -1;
+    s->mode = 0;
   }
-  if (x0 >= 0 && y0 >= 0)
-    select_region((int)xx,(int)yy,(int)x0,(int)y0);
-  else
-    draw_pointer((int)xx,(int)yy);
+  schedule_render(s);
+}
+
+void
+get_pointer(struct seat *s, int *x, int *y, enum current_button *b)
+{
+  *x = (int)s->xx;
+  *y = (int)s->yy;
+  *b = s->button;
 }
 
 static void
@@ -56,64 +106,82 @@ select_mode(int mode, int xx, int yy, int x0, int y0)
 }
 
 void
-move_pointer(double x, double y)
+move_pointer(struct seat *s, double x, double y)
 {
-  xx += x/20; yy += y/20;
-  if (xx < 1) xx = 1; else if (xx > screen_width)  xx = screen_width;
-  if (yy < 1) yy = 1; else if (yy > screen_height) yy = screen_height;
+  s->xx += x/20; s->yy += y/20;
+  clamp_pointer(s);
   if (mouse_reporting != MOUSE_REPORTING_OFF)
   {
-    x0 = -1; y0 = -1;
-    mode = 0;
+    s->x0 = -1; s->y0 = -1;
+    s->mode = 0;
   }
-  if (x0 >= 0 && y0 >= 0)
-    select_mode(mode,(int)xx,(int)yy,(int)x0,(int)y0);
+  schedule_render(s);
+}
+
+void
+render_pointer(struct seat *s)
+{
+  if (s->x0 >= 0 && s->y0 >= 0 && s->smart)
+    select_region(s->smart_xs,(int)s->y0,s->smart_xe,(int)s->y0);
+  else if (s->x0 >= 0 && s->y0 >= 0)
+    select_mode(s->mode,(int)s->xx,(int)s->yy,(int)s->x0,(int)s->y0);
   else
-    draw_pointer((int)xx,(int)yy);
+  {
+    if (mouse_reporting != MOUSE_REPORTING_OFF)
+      report_moved(s);
+    draw_pointer((int)s->xx,(int)s->yy);
+  }
 }
 
 void
-press_left_button(void)
+press_left_button(struct seat *s)
 {
   if (mouse_reporting != MOUSE_REPORTING_OFF)
   {
-    button = BUTTON_LEFT;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_LEFT;
+    report(s);
   }
   else
   {
-    if ((int)x1==(int)xx && (int)y1==(int)yy)
-    {
-      mode = (mode+1)%3;
-      select_mode(mode,(int)xx,(int)yy,(int)xx,(int)yy);
-    }
+    /* A click always reaches the kernel, even on an unchanged
+       selection, so that the paste buffer picks up the current text. */
+    selection_invalidate();
+    s->smart = 0;
+    if ((int)s->x1==(int)s->xx && (int)s->y1==(int)s->yy)
+      s->mode = (s->mode+1)%3;
     else
-    {
-      mode = 0;
-      select_region((int)xx,(int)yy,(int)xx,(int)yy);
-    }
-    x0=xx; y0=yy; x1=x0; y1=y0;
+      s->mode = 0;
+    if (s->mode+1 == smart_select)
+      s->smart = !smart_match((int)s->xx,(int)s->yy,
+                              &s->smart_xs,&s->smart_xe);
+    if (s->smart)
+      select_region(s->smart_xs,(int)s->yy,s->smart_xe,(int)s->yy);
+    else
+      select_mode(s->mode,(int)s->xx,(int)s->yy,(int)s->xx,(int)s->yy);
+    s->x0=s->xx; s->y0=s->yy; s->x1=s->x0; s->y1=s->y0;
   }
 }
 
 void
-release_left_button(void)
+release_left_button(struct seat *s)
 {
   if (mouse_reporting == MOUSE_REPORTING_X11)
   {
-    button = BUTTON_RELEASED;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_RELEASED;
+    report(s);
   }
-  x0=-1; y0=-1;
+  else if (s->x0 >= 0 && s->y0 >= 0 && mouse_reporting == MOUSE_REPORTING_OFF)
+    history_add_selection();
+  s->x0=-1; s->y0=-1;
 }
 
 void
-press_middle_button(void)
+press_middle_button(struct seat *s)
 {
   if (mouse_reporting != MOUSE_REPORTING_OFF)
   {
-    button = BUTTON_MIDDLE;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_MIDDLE;
+    report(s);
   }
   else
   {
@@ -122,43 +190,56 @@ press_middle_button(void)
 }
 
 void
-release_middle_button(void)
+release_middle_button(struct seat *s)
 {
   if (mouse_reporting == MOUSE_REPORTING_X11)
   {
-    button = BUTTON_RELEASED;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_RELEASED;
+    report(s);
   }
 }
 
 void
-press_right_button(void)
+press_right_button(struct seat *s)
 {
   if (mouse_reporting != MOUSE_REPORTING_OFF)
   {
-    button = BUTTON_RIGHT;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_RIGHT;
+    report(s);
   }
   else
   {
-    if (x1>=0 && y1>=0)
-      select_region((int)xx,(int)yy,(int)x1,(int)y1);
+    if (s->x1>=0 && s->y1>=0)
+    {
+      selection_invalidate();
+      select_region((int)s->xx,(int)s->yy,(int)s->x1,(int)s->y1);
+      history_add_selection();
+    }
   }
 }
 
 void
-release_right_button(void)
+release_right_button(struct seat *s)
 {
   if (mouse_reporting == MOUSE_REPORTING_X11)
   {
-    button = BUTTON_RELEASED;
-    report_pointer((int)xx,(int)yy,button);
+    s->button = BUTTON_RELEASED;
+    report(s);
   }
 }
 
+/* v120 is in 1/120 of a wheel detent. The fraction of a line that is
+   not scrolled yet is kept for the next call, unless the direction
+   changes. */
 void
-vertical_axis(double v)
+vertical_axis(struct seat *s, int v120)
 {
-  if (v)
-    scroll(v > 0 ? 2 : -2);
+  int lines;
+  if ((s->scroll_rest > 0 && v120 < 0) || (s->scroll_rest < 0 && v120 > 0))
+    s->scroll_rest = 0;
+  s->scroll_rest += v120 * scroll_lines;
+  lines = s->scroll_rest / 120;
+  s->scroll_rest -= lines * 120;
+  if (lines) /* 0 would scroll half a screen */
+    scroll(lines);
 }
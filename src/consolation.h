@@ -15,9 +15,14 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <stdio.h>
+#include <stdint.h>
+
 /* options */
 
 extern int nodaemon;
+extern int scroll_lines;
+extern int threaded;
 
 enum current_button {
   BUTTON_LEFT,
@@ -33,16 +38,246 @@ enum mouse_reporting_mode {
   MOUSE_REPORTING_MODE_COUNT
 };
 
+/* How mouse reports reach the application: through the kernel, which
+   only reports button presses, or typed by us as escape sequences. */
+enum mouse_encoding {
+  MOUSE_ENCODING_KERNEL,
+  MOUSE_ENCODING_X11,
+  MOUSE_ENCODING_SGR
+};
+
+enum mouse_motion {
+  MOUSE_MOTION_NONE,
+  MOUSE_MOTION_DRAG,
+  MOUSE_MOTION_ANY
+};
+
+/* input events, as recorded and replayed */
+
+enum csl_event_type {
+  CSL_EVENT_SYNC,            /* end of a batch of events */
+  CSL_EVENT_MOTION,          /* x, y: relative motion */
+  CSL_EVENT_MOTION_ABSOLUTE, /* x, y: position, in [0,1] */
+  CSL_EVENT_BUTTON,          /* code: button, state: pressed or released */
+  CSL_EVENT_AXIS,            /* x, y: vertical and horizontal values,
+                                code: CSL_AXIS_*, state: axis source,
+                                value: vertical v120 for wheels */
+  CSL_EVENT_TOUCH_DOWN,      /* value: slot, x, y: position, in [0,1] */
+  CSL_EVENT_TOUCH_MOTION,
+  CSL_EVENT_TOUCH_UP,        /* value: slot */
+  CSL_EVENT_TOUCH_FRAME,
+  CSL_EVENT_TOUCH_CANCEL     /* all touches are dropped */
+};
+
+#define CSL_AXIS_VERTICAL   1
+#define CSL_AXIS_HORIZONTAL 2
+
+struct csl_event {
+  uint64_t time;  /* usec, as reported by libinput */
+  float x, y;
+  uint16_t code;
+  uint8_t type;
+  uint8_t state;
+  int32_t value;
+};
+
 /* global state */
 
 extern unsigned int screen_width;
 extern unsigned int screen_height;
 extern enum mouse_reporting_mode mouse_reporting;
+extern enum mouse_encoding mouse_encoding;
+extern enum mouse_motion mouse_motion;
+
+/* seat.c */
+
+#define MAX_SEATS 16
+
+struct libinput;
+
+struct kinetic {
+  int timer_fd;
+  double velocity;     /* units/s */
+  double distance;     /* units not scrolled yet */
+  uint64_t last_sample;
+  uint64_t last_frame;
+  int coasting;
+};
+
+#define MAX_TOUCH_SLOTS 10
+
+struct touch {
+  int down;
+  double x, y;         /* position, in cells */
+};
+
+struct seat {
+  const char *name;
+  uint64_t vts;        /* bit n for VT n, 0 for all */
+  struct libinput *li;
+  int suspended;
+  int render_pending;
+  /* pointer and selection, see action.c */
+  double xx, yy, x0, y0, x1, y1;
+  int mode;
+  int smart, smart_xs, smart_xe;  /* smart selection on row y0 */
+  enum current_button button;
+  int scroll_rest;
+  int report_x, report_y;  /* cell of the last mouse report */
+  enum current_button report_pressed;  /* button of the last press */
+  /* input batched by input.c */
+  struct {
+    double dx, dy;
+    int relative;
+    double x, y;
+    int absolute;
+  } motion;
+  int axis_v120;
+  double axis_rest;  /* fraction of v120 from finger scrolling */
+  /* touchscreen gesture, see input.c */
+  struct touch touch[MAX_TOUCH_SLOTS];
+  int touches, primary, gesture;
+  double touch_x0, touch_y0, scroll_y;
+  uint64_t touch_time;
+  struct kinetic kinetic;
+};
+
+extern struct seat seats[MAX_SEATS];
+extern int nseats;
+int seat_add(const char *spec);
+int seat_active(const struct seat *s);
+struct seat *seat_current(void);
+void seat_close(void);
+
+/* console backends */
+
+struct console_backend {
+  const char *name;
+  int (*watch_fd)(void);   /* fd polled for VT switches, or -1 */
+  int (*active_vt)(void);
+  int (*text_mode)(void);  /* 1 for KD_TEXT, 0 otherwise, -1 on error */
+  int (*get_size)(unsigned int *width, unsigned int *height);
+  int (*get_mouse_reporting)(unsigned char *mode);
+  int (*set_selection)(int xs, int ys, int xe, int ye, int sel_mode);
+  int (*paste)(void);
+  int (*scroll)(int sc);
+  int (*load_lut)(const uint32_t *lut);
+  /* Unicode text of the foreground console from cell offset, or -1 */
+  int (*read_text)(unsigned int offset, uint32_t *text, unsigned int count);
+  /* Cells (character | attribute << 8) of a VT, as in /dev/vcsaN. Reading
+     fails unless the screen is width x height. */
+  int (*read_screen)(int vt, uint16_t *cells, unsigned int width,
+      unsigned int height);
+  int (*write_screen)(int vt, unsigned int offset, const uint16_t *cells,
+      unsigned int count);
+  /* Bytes waiting in the input queue of a VT, typing text into it, and
+     whether the foreground application wants bracketed paste (1, 0 or
+     -1 if unknown). inject returns the number of bytes typed. */
+  int (*input_queued)(int vt);
+  int (*inject)(int vt, const char *text, unsigned int len);
+  int (*bracketed_paste)(void);
+  void (*close)(void);
+};
+
+/* linuxconsole.c */
+
+extern const struct console_backend linux_console;
+extern unsigned long console_reopens;
+
+/* fakeconsole.c */
+
+extern const struct console_backend fake_console;
+void fake_console_init(const char *trace_path, long latency_usec);
+void fake_console_report(FILE *f);
+
+/* queue.c */
+
+int queue_init(void);
+void queue_drain(void);
+void queue_report(FILE *f);
+
+/* console.c */
+
+extern const struct console_backend *console;
+extern unsigned long console_cache_hits;
+extern unsigned long console_cache_misses;
+extern int console_active_vt;
+void console_close(void);
+uint64_t now_usec(void);
+uint64_t now_nsec(void);
+int console_vt_fd(void);
+void console_vt_changed(void);
+void console_invalidate(void);
+void console_update_state(void);
+int console_text_mode(void);
+int console_read_row(int y, uint32_t *text);
+
+/* words.c */
+
+void words_set_lut(const uint32_t *lut);
+int words_add_classes(const char *spec);
+int word_boundary(const uint32_t *text, int width, int x, int dir);
+
+/* smart.c */
+
+extern int smart_select;
+int smart_add_pattern(const char *re);
+int smart_init(void);
+int smart_match(int x, int y, int *xs, int *xe);
+
+/* scrollback.c */
+
+int scrollback_init(long kb, long interval_ms);
+int scrollback_scroll(int lines);
+void scrollback_report(FILE *f);
+void scrollback_close(void);
+
+/* ipc.c */
+
+struct csl_msg;
+struct ipc_server;
+struct ipc_client;
+typedef void (*ipc_handler)(struct ipc_client *c, const struct csl_msg *req,
+    const void *payload);
+struct ipc_server *ipc_listen(const char *path, ipc_handler handler);
+void ipc_reply(struct ipc_client *c, const struct csl_msg *req, int status,
+    const void *payload, size_t len);
+void ipc_reply_append(struct ipc_client *c, const void *data, size_t len);
+void ipc_close(struct ipc_server *s);
+
+/* history.c */
+
+int history_init(const char *path, int max);
+void history_add_selection(void);
+void history_request(struct ipc_client *c, const struct csl_msg *req,
+    const void *payload);
+void history_close(void);
+
+/* inject.c */
+
+int inject_init(void);
+int inject_text(const struct ipc_client *c, const char *s, size_t n,
+                unsigned int flags);
+void inject_detach(const struct ipc_client *c);
+int inject_sequence(const char *s, size_t n);
+void inject_report(FILE *f);
+void inject_close(void);
+
+/* control.c */
+
+int control_init(const char *path);
+void control_close(void);
 
 /* selection.c */
 
+extern unsigned long console_operations;
+extern unsigned long selection_emitted;
+extern unsigned long selection_suppressed;
+void selection_invalidate(void);
+int selection_get(int *xs, int *ys, int *xe, int *ye, int *sel_mode);
 void set_screen_size_and_mouse_reporting(void);
-void report_pointer(int x, int y, enum current_button button);
+void report_pointer(struct seat *s);
+void report_motion(struct seat *s);
 void draw_pointer(int x, int y);
 void select_region(int x, int y, int x2, int y2);
 void select_words(int x, int y, int x2, int y2);
@@ -53,17 +288,104 @@ void set_lut(const char *word_chars);
 
 /* action.c */
 
-void set_pointer(double x, double y);
-void move_pointer(double x, double y);
-void press_left_button(void);
-void release_left_button(void);
-void press_middle_button(void);
-void release_middle_button(void);
-void press_right_button(void);
-void release_right_button(void);
-void vertical_axis(double v);
+void action_init(struct seat *s);
+void get_pointer(struct seat *s, int *x, int *y, enum current_button *b);
+void set_pointer(struct seat *s, double x, double y);
+void render_pointer(struct seat *s);
+void move_pointer(struct seat *s, double x, double y);
+void press_left_button(struct seat *s);
+void release_left_button(struct seat *s);
+void press_middle_button(struct seat *s);
+void release_middle_button(struct seat *s);
+void press_right_button(struct seat *s);
+void release_right_button(struct seat *s);
+void vertical_axis(struct seat *s, int v120);
+
+/* loop.c */
+
+struct loop_source;
+typedef void (*loop_handler)(int fd, uint32_t events, void *data);
+int loop_init(void);
+struct loop_source *loop_add(int fd, uint32_t events, loop_handler handler,
+    void *data);
+int loop_modify(struct loop_source *s, uint32_t events);
+void loop_remove(struct loop_source *s);
+int loop_run(void);
+void loop_stop(void);
+void loop_close(void);
+
+/* schedule.c */
+
+int schedule_init(int max_fps);
+void schedule_render(struct seat *s);
+void schedule_flush(void);
+
+/* metrics.c */
+
+enum metric_event {
+  METRIC_EVENT_DEVICE_ADDED = CSL_EVENT_TOUCH_CANCEL + 1,
+  METRIC_EVENT_DEVICE_REMOVED,
+  METRIC_EVENT_OTHER,
+  METRIC_EVENT_COUNT
+};
+
+enum metric_op {
+  METRIC_OP_SETSEL,
+  METRIC_OP_PASTESEL,
+  METRIC_OP_SELLOADLUT,
+  METRIC_OP_GETMOUSEREPORTING,
+  METRIC_OP_SCROLLCONSOLE,
+  METRIC_OP_KDGETMODE,
+  METRIC_OP_TIOCGWINSZ,
+  METRIC_OP_ACTIVE_VT,
+  METRIC_OP_TIOCSTI,
+  METRIC_OP_COUNT
+};
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_EXP 40
+#define HIST_BUCKETS (HIST_EXP * HIST_SUB)
+
+struct histogram {
+  unsigned long count[HIST_BUCKETS];
+  unsigned long total;
+  uint64_t max;
+};
+
+extern unsigned long metrics_events[METRIC_EVENT_COUNT];
+extern unsigned long metrics_wakeups;
+extern unsigned long metrics_errors;
+void hist_add(struct histogram *h, uint64_t v);
+uint64_t hist_percentile(const struct histogram *h, double p);
+uint64_t metrics_start(void);
+void metrics_op(enum metric_op op, uint64_t start, int err);
+void metrics_input(uint64_t time);
+void metrics_input_clear(void);
+void metrics_use_syslog(void);
+void metrics_write(FILE *f);
+void metrics_dump(void);
+
+/* record.c */
+
+int record_open(const char *path);
+void record_event(const struct csl_event *e);
+void record_sync(void);
+void record_close(void);
+int replay(const char *path);
+
+/* kinetic.c */
+
+extern int kinetic_scrolling;
+int kinetic_init(struct seat *s);
+void kinetic_sample(struct seat *s, uint64_t time, double units);
+void kinetic_release(struct seat *s, uint64_t time);
+void kinetic_cancel(struct seat *s);
+void kinetic_close(struct seat *s);
 
 /* input.c */
 
+void input_dispatch(struct seat *s, const struct csl_event *e);
+void input_flush(struct seat *s);
 int event_init(int argc, char **argv);
 int event_main(void);
@@ -0,0 +1,404 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+
+/* Client of the control socket of consolation.
+
+   The commands given on the command line are sent in one batch, and the
+   replies printed in order. Without commands, they are read from the
+   standard input, one batch per line, on the same connection.
+*/
+
+static uint8_t request[sizeof(struct csl_msg) + CSL_MAX_PAYLOAD];
+static size_t request_len = 0;
+static int requests = 0;
+
+static void
+usage(void)
+{
+  printf("Usage: consolationctl [--socket=<path>] [command...]\n"
+         "Commands:\n"
+         "  select <xs> <ys> <xe> <ye> [char|word|line]\n"
+         "  paste\n"
+         "  paste-file <file>|- [raw|bracketed]\n"
+         "  scroll <lines>\n"
+         "  pointer\n"
+         "  selection\n"
+         "  screen\n"
+         "  metrics\n"
+         "  history [<index>]\n");
+}
+
+static int
+add(uint16_t type, const void *payload, uint32_t len)
+{
+  struct csl_msg m;
+  if (request_len + sizeof(m) + len > sizeof(request))
+  {
+    fprintf(stderr, "too many commands\n");
+    return -1;
+  }
+  m.length = len;
+  m.type = type;
+  m.status = 0;
+  memcpy(request + request_len, &m, sizeof(m));
+  memcpy(request + request_len + sizeof(m), payload, len);
+  request_len += sizeof(m) + len;
+  requests++;
+  return 0;
+}
+
+/* Parse the command in argv and add it to the batch. Return the number
+   of words used, or -1. */
+
+static int
+parse(int argc, char **argv)
+{
+  const char *cmd = argv[0];
+  if (!strcmp(cmd, "select") && argc >= 5)
+  {
+    struct csl_selection s;
+    int n = 5;
+    s.xs = atoi(argv[1]);
+    s.ys = atoi(argv[2]);
+    s.xe = atoi(argv[3]);
+    s.ye = atoi(argv[4]);
+    s.mode = CSL_SELECT_CHAR;
+    if (argc > 5 && (!strcmp(argv[5], "char") || !strcmp(argv[5], "word")
+                     || !strcmp(argv[5], "line")))
+    {
+      s.mode = argv[5][0] == 'c' ? CSL_SELECT_CHAR
+             : argv[5][0] == 'w' ? CSL_SELECT_WORD : CSL_SELECT_LINE;
+      n++;
+    }
+    return add(CSL_MSG_SET_SELECTION, &s, sizeof(s)) ? -1 : n;
+  }
+  if (!strcmp(cmd, "paste"))
+    return add(CSL_MSG_PASTE, NULL, 0) ? -1 : 1;
+  if (!strcmp(cmd, "scroll") && argc >= 2)
+  {
+    int32_t lines = atoi(argv[1]);
+    return add(CSL_MSG_SCROLL, &lines, sizeof(lines)) ? -1 : 2;
+  }
+  if (!strcmp(cmd, "pointer"))
+    return add(CSL_MSG_QUERY_POINTER, NULL, 0) ? -1 : 1;
+  if (!strcmp(cmd, "selection"))
+    return add(CSL_MSG_QUERY_SELECTION, NULL, 0) ? -1 : 1;
+  if (!strcmp(cmd, "screen"))
+    return add(CSL_MSG_QUERY_SCREEN, NULL, 0) ? -1 : 1;
+  if (!strcmp(cmd, "metrics"))
+    return add(CSL_MSG_METRICS, NULL, 0) ? -1 : 1;
+  if (!strcmp(cmd, "history"))
+  {
+    char *end;
+    uint32_t index;
+    if (argc < 2)
+      return add(CSL_MSG_HISTORY_LIST, NULL, 0) ? -1 : 1;
+    index = strtoul(argv[1], &end, 10);
+    if (*end || end == argv[1])
+      return add(CSL_MSG_HISTORY_LIST, NULL, 0) ? -1 : 1;
+    return add(CSL_MSG_HISTORY_GET, &index, sizeof(index)) ? -1 : 2;
+  }
+  fprintf(stderr, "invalid command: %s\n", cmd);
+  return -1;
+}
+
+static void
+print_reply(const struct csl_msg *m, const uint8_t *p)
+{
+  if (m->status)
+  {
+    printf("error: %s\n", strerror(m->status));
+    return;
+  }
+  switch (m->type)
+  {
+  case CSL_MSG_QUERY_POINTER:
+  {
+    struct csl_pointer ptr;
+    memcpy(&ptr, p, sizeof(ptr));
+    printf("pointer %d %d %d\n", ptr.x, ptr.y, ptr.button);
+    break;
+  }
+  case CSL_MSG_QUERY_SELECTION:
+  {
+    struct csl_selection s;
+    memcpy(&s, p, sizeof(s));
+    printf("selection %d %d %d %d %s\n", s.xs, s.ys, s.xe, s.ye,
+        s.mode == CSL_SELECT_WORD ? "word"
+        : s.mode == CSL_SELECT_LINE ? "line" : "char");
+    break;
+  }
+  case CSL_MSG_QUERY_SCREEN:
+  {
+    struct csl_screen s;
+    memcpy(&s, p, sizeof(s));
+    printf("screen %ux%u vt %u %s mouse-reporting %u\n", s.width, s.height,
+        s.active_vt, s.text_mode ? "text" : "graphics", s.mouse_reporting);
+    break;
+  }
+  case CSL_MSG_HISTORY_COUNT:
+  {
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    printf("%u\n", n);
+    break;
+  }
+  case CSL_MSG_HISTORY_LIST:
+  {
+    uint32_t off = 0, len;
+    while (off + sizeof(len) <= m->length)
+    {
+      memcpy(&len, p + off, sizeof(len));
+      off += sizeof(len);
+      fwrite(p + off, 1, len, stdout);
+      putchar('\n');
+      off += len;
+    }
+    break;
+  }
+  case CSL_MSG_HISTORY_GET:
+    fwrite(p, 1, m->length, stdout);
+    putchar('\n');
+    break;
+  case CSL_MSG_METRICS:
+    fwrite(p, 1, m->length, stdout);
+    break;
+  default:
+    break;
+  }
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+  uint8_t *p = buf;
+  while (len)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Send the batch and print the replies. */
+
+static int
+send_batch(int fd)
+{
+  size_t done = 0;
+  int status = 0;
+  static uint8_t payload[CSL_MAX_PAYLOAD];
+  while (done < request_len)
+  {
+    ssize_t n = write(fd, request + done, request_len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      perror("write");
+      return -1;
+    }
+    done += n;
+  }
+  for (; requests > 0; requests--)
+  {
+    struct csl_msg m;
+    if (read_full(fd, &m, sizeof(m)) || m.length > CSL_MAX_PAYLOAD
+        || read_full(fd, payload, m.length))
+    {
+      fprintf(stderr, "connection lost\n");
+      return -1;
+    }
+    print_reply(&m, payload);
+    if (m.status)
+      status = 1;
+  }
+  request_len = 0;
+  fflush(stdout);
+  return status;
+}
+
+/* Type the contents of a file into the console, one frame at a time,
+   retrying while the daemon is busy. */
+
+static int
+paste_file(int fd, const char *path, uint32_t flags)
+{
+  static uint8_t payload[CSL_MAX_PAYLOAD];
+  FILE *f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+  size_t n;
+  int status = 0;
+  if (!f)
+  {
+    perror(path);
+    return -1;
+  }
+  do
+  {
+    uint32_t fl = flags;
+    struct csl_msg m;
+    n = fread(payload + sizeof(fl), 1, CSL_MAX_PAYLOAD - sizeof(fl), f);
+    if (n == CSL_MAX_PAYLOAD - sizeof(fl))
+      fl |= CSL_PASTE_CONTINUE;
+    memcpy(payload, &fl, sizeof(fl));
+    for (;;)
+    {
+      request_len = 0;
+      requests = 0;
+      add(CSL_MSG_PASTE_TEXT, payload, sizeof(fl) + n);
+      if (write(fd, request, request_len) != (ssize_t)request_len
+          || read_full(fd, &m, sizeof(m)) || m.length)
+      {
+        fprintf(stderr, "connection lost\n");
+        status = -1;
+        break;
+      }
+      if (m.status != ENOBUFS && m.status != EBUSY)
+        break;
+      usleep(10000);
+    }
+    requests = 0;
+    request_len = 0;
+    if (!status && m.status)
+    {
+      printf("error: %s\n", strerror(m.status));
+      status = 1;
+    }
+  }
+  while (!status && n == CSL_MAX_PAYLOAD - sizeof(uint32_t));
+  if (f != stdin)
+    fclose(f);
+  return status;
+}
+
+static int
+run(int fd, int argc, char **argv)
+{
+  while (argc > 0)
+  {
+    int n;
+    if (!strcmp(argv[0], "paste-file") && argc >= 2)
+    {
+      uint32_t flags = 0;
+      int rc;
+      n = 2;
+      if (argc > 2 && !strcmp(argv[2], "raw"))
+        flags = CSL_PASTE_RAW;
+      else if (argc > 2 && !strcmp(argv[2], "bracketed"))
+        flags = CSL_PASTE_BRACKETED;
+      if (flags)
+        n++;
+      if ((rc = send_batch(fd)) || (rc = paste_file(fd, argv[1], flags)))
+        return rc;
+      argc -= n;
+      argv += n;
+      continue;
+    }
+    n = parse(argc, argv);
+    if (n < 0)
+      return -1;
+    argc -= n;
+    argv += n;
+  }
+  return send_batch(fd);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *path = CSL_CONTROL_SOCKET;
+  struct sockaddr_un addr;
+  int fd, c, rc = 0;
+  static struct option opts[] = {
+    { "socket", required_argument, 0, 's' },
+    { "help",   no_argument,       0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  while ((c = getopt_long(argc, argv, "+s:h", opts, NULL)) != -1)
+    switch (c)
+    {
+    case 's':
+      path = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 2;
+    }
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return 2;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    perror("socket");
+    return 2;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    perror(path);
+    return 2;
+  }
+
+  if (optind < argc)
+    rc = run(fd, argc - optind, argv + optind);
+  else
+  {
+    char line[4096];
+    while (fgets(line, sizeof(line), stdin))
+    {
+      char *words[256], *save, *w;
+      int n = 0;
+      for (w = strtok_r(line, " \t\n", &save); w && n < 256;
+           w = strtok_r(NULL, " \t\n", &save))
+        words[n++] = w;
+      if (n && run(fd, n, words) < 0)
+      {
+        rc = 1;
+        break;
+      }
+    }
+  }
+  close(fd);
+  return rc < 0 ? 1 : rc;
+}
@@ -0,0 +1,163 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "consolation.h"
+
+const struct console_backend *console = &linux_console;
+
+/* Console state cache.
+
+   The screen geometry, the mouse reporting mode and the KD mode of the
+   foreground console are kept in memory. Nothing notifies us when an
+   application enables mouse reporting or the console is resized, so the
+   first two expire after STATE_TTL. The KD mode only changes when X or a
+   similar program takes over a VT, which in practice comes with a VT
+   switch: it is invalidated by VT switches and otherwise expires after
+   MODE_TTL.
+
+   VT switches are detected by polling the watch fd of the backend (for
+   Linux, /sys/class/tty/tty0/active, which the kernel notifies on every
+   switch). Without one, the active VT is queried whenever the state
+   expires.
+*/
+
+#define STATE_TTL 100000  /* usec */
+#define MODE_TTL  1000000 /* usec */
+
+static uint64_t state_expiry = 0;
+static uint64_t mode_expiry = 0;
+static int text_mode = 0;
+static int vt_fd = -1;
+int console_active_vt = 0;
+unsigned long console_cache_hits = 0;
+unsigned long console_cache_misses = 0;
+
+uint64_t
+now_usec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+uint64_t
+now_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int
+active_vt(void)
+{
+  uint64_t t = metrics_start();
+  int vt = console->active_vt();
+  metrics_op(METRIC_OP_ACTIVE_VT, t, vt ? 0 : -1);
+  return vt;
+}
+
+void
+console_invalidate(void)
+{
+  state_expiry = 0;
+  mode_expiry = 0;
+}
+
+static void
+set_active_vt(int vt)
+{
+  if (vt != console_active_vt)
+  {
+    console_active_vt = vt;
+    console_invalidate();
+    selection_invalidate();
+  }
+}
+
+int
+console_vt_fd(void)
+{
+  if (vt_fd == -1)
+  {
+    vt_fd = console->watch_fd();
+    if (vt_fd != -1)
+      set_active_vt(active_vt());
+  }
+  return vt_fd;
+}
+
+void
+console_vt_changed(void)
+{
+  set_active_vt(active_vt());
+}
+
+void
+console_update_state(void)
+{
+  uint64_t now = now_usec();
+  if (now < state_expiry)
+  {
+    console_cache_hits++;
+    return;
+  }
+  console_cache_misses++;
+  if (vt_fd == -1)
+    set_active_vt(active_vt());
+  set_screen_size_and_mouse_reporting();
+  state_expiry = now + STATE_TTL;
+}
+
+int
+console_text_mode(void)
+{
+  uint64_t t, now = now_usec();
+  if (now < mode_expiry)
+  {
+    console_cache_hits++;
+    return text_mode;
+  }
+  console_cache_misses++;
+  t = metrics_start();
+  text_mode = console->text_mode();
+  metrics_op(METRIC_OP_KDGETMODE, t, text_mode);
+  text_mode = text_mode == 1;
+  mode_expiry = now + MODE_TTL;
+  return text_mode;
+}
+
+/* Read row y (from 1) of the screen into text, which must hold
+   screen_width characters. */
+
+int
+console_read_row(int y, uint32_t *text)
+{
+  int n = console->read_text((y-1)*screen_width, text, screen_width);
+  return n == (int)screen_width ? 0 : -1;
+}
+
+void
+console_close(void)
+{
+  console->close();
+  vt_fd = -1;
+}
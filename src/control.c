@@ -0,0 +1,198 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/tiocl.h>
+
+#include "consolation.h"
+#include "protocol.h"
+
+/* Control socket.
+
+   With --control-socket, the daemon accepts on a Unix socket the same
+   operations as from the mouse, and queries of its state. See protocol.h
+   and consolationctl. The requests are handled in the main loop, between
+   input events, so that they see and update the same state.
+*/
+
+static struct ipc_server *server = NULL;
+
+static int
+set_selection(const struct csl_selection *s)
+{
+  console_update_state();
+  if (s->xs < 1 || s->ys < 1 || s->xe < 1 || s->ye < 1
+      || s->xs > (int)screen_width || s->xe > (int)screen_width
+      || s->ys > (int)screen_height || s->ye > (int)screen_height)
+    return EINVAL;
+  selection_invalidate();
+  switch (s->mode)
+  {
+  case CSL_SELECT_CHAR:
+    select_region(s->xs, s->ys, s->xe, s->ye);
+    break;
+  case CSL_SELECT_WORD:
+    select_words(s->xs, s->ys, s->xe, s->ye);
+    break;
+  case CSL_SELECT_LINE:
+    select_lines(s->xs, s->ys, s->xe, s->ye);
+    break;
+  default:
+    return EINVAL;
+  }
+  history_add_selection();
+  return 0;
+}
+
+static void
+query_selection(struct ipc_client *c, const struct csl_msg *req)
+{
+  struct csl_selection s;
+  int mode;
+  if (selection_get(&s.xs, &s.ys, &s.xe, &s.ye, &mode))
+  {
+    ipc_reply(c, req, ENOENT, NULL, 0);
+    return;
+  }
+  s.mode = mode == TIOCL_SELWORD ? CSL_SELECT_WORD
+         : mode == TIOCL_SELLINE ? CSL_SELECT_LINE : CSL_SELECT_CHAR;
+  ipc_reply(c, req, 0, &s, sizeof(s));
+}
+
+static void
+query_metrics(struct ipc_client *c, const struct csl_msg *req)
+{
+  char *buf = NULL;
+  size_t size;
+  FILE *f = open_memstream(&buf, &size);
+  if (!f)
+  {
+    ipc_reply(c, req, errno, NULL, 0);
+    return;
+  }
+  metrics_write(f);
+  fclose(f);
+  ipc_reply(c, req, 0, buf, size);
+  free(buf);
+}
+
+static void
+serve(struct ipc_client *c, const struct csl_msg *req, const void *payload)
+{
+  switch (req->type)
+  {
+  case CSL_MSG_SET_SELECTION:
+  {
+    struct csl_selection s;
+    if (req->length != sizeof(s))
+    {
+      ipc_reply(c, req, EINVAL, NULL, 0);
+      break;
+    }
+    memcpy(&s, payload, sizeof(s));
+    ipc_reply(c, req, set_selection(&s), NULL, 0);
+    break;
+  }
+  case CSL_MSG_PASTE:
+    paste();
+    ipc_reply(c, req, 0, NULL, 0);
+    break;
+  case CSL_MSG_SCROLL:
+  {
+    int32_t lines;
+    if (req->length != sizeof(lines))
+    {
+      ipc_reply(c, req, EINVAL, NULL, 0);
+      break;
+    }
+    memcpy(&lines, payload, sizeof(lines));
+    if (lines)
+      scroll(lines);
+    ipc_reply(c, req, 0, NULL, 0);
+    break;
+  }
+  case CSL_MSG_QUERY_POINTER:
+  {
+    struct csl_pointer p;
+    int x, y;
+    enum current_button b;
+    get_pointer(seat_current(), &x, &y, &b);
+    p.x = x;
+    p.y = y;
+    p.button = b;
+    ipc_reply(c, req, 0, &p, sizeof(p));
+    break;
+  }
+  case CSL_MSG_QUERY_SELECTION:
+    query_selection(c, req);
+    break;
+  case CSL_MSG_QUERY_SCREEN:
+  {
+    struct csl_screen s;
+    console_update_state();
+    s.width = screen_width;
+    s.height = screen_height;
+    s.active_vt = console_active_vt;
+    s.text_mode = console_text_mode();
+    s.mouse_reporting = mouse_reporting;
+    ipc_reply(c, req, 0, &s, sizeof(s));
+    break;
+  }
+  case CSL_MSG_METRICS:
+    query_metrics(c, req);
+    break;
+  case CSL_MSG_PASTE_TEXT:
+  {
+    uint32_t flags;
+    if (req->length < sizeof(flags))
+    {
+      ipc_reply(c, req, EINVAL, NULL, 0);
+      break;
+    }
+    memcpy(&flags, payload, sizeof(flags));
+    ipc_reply(c, req, inject_text(c, (const char *)payload + sizeof(flags),
+          req->length - sizeof(flags), flags), NULL, 0);
+    break;
+  }
+  default:
+    history_request(c, req, payload);
+    break;
+  }
+}
+
+int
+control_init(const char *path)
+{
+  if (!path)
+    return 0;
+  if (inject_init())
+    return 1;
+  server = ipc_listen(path, serve);
+  return server ? 0 : 1;
+}
+
+void
+control_close(void)
+{
+  ipc_close(server);
+  server = NULL;
+  inject_close();
+}
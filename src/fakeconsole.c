@@ -0,0 +1,330 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <linux/tiocl.h>
+
+#include "consolation.h"
+
+/* In-memory console.
+
+   It behaves like a 80x25 text console without mouse reporting, records
+   every operation it receives, and optionally sleeps for a fixed time in
+   each call to simulate the cost of the ioctl. The recorded operations are
+   written as text to the trace file, if any, when the console is closed,
+   so that runs of the daemon can be compared with diff(1).
+
+   The screen is numbered lines of text that scroll by one line every time
+   it is read through read_screen, as if a program were printing.
+*/
+
+#define FAKE_MAX_OPS 1000000
+
+enum fake_op_type {
+  FAKE_OP_SELECTION,
+  FAKE_OP_PASTE,
+  FAKE_OP_SCROLL,
+  FAKE_OP_LOAD_LUT,
+  FAKE_OP_WRITE_SCREEN,
+  FAKE_OP_INJECT,
+  FAKE_OP_QUERY,
+  FAKE_OP_COUNT
+};
+
+static const char *fake_op_names[FAKE_OP_COUNT] = {
+  "selection", "paste", "scroll", "load_lut", "write_screen", "inject",
+  "query"
+};
+
+struct fake_op {
+  enum fake_op_type type;
+  int arg[5];
+};
+
+static struct fake_op *ops = NULL;
+static size_t nops = 0;
+static unsigned long counts[FAKE_OP_COUNT];
+static const char *trace_path = NULL;
+static long latency = 0;
+
+void
+fake_console_init(const char *path, long latency_usec)
+{
+  trace_path = path;
+  latency = latency_usec;
+}
+
+static void
+record(enum fake_op_type type, int a, int b, int c, int d, int e)
+{
+  counts[type]++;
+  if (latency > 0)
+  {
+    struct timespec ts = { latency/1000000, (latency%1000000)*1000 };
+    nanosleep(&ts, NULL);
+  }
+  if (type == FAKE_OP_QUERY)
+    return;
+  if (!ops)
+    ops = malloc(FAKE_MAX_OPS * sizeof(*ops));
+  if (!ops || nops == FAKE_MAX_OPS)
+    return;
+  ops[nops].type = type;
+  ops[nops].arg[0] = a;
+  ops[nops].arg[1] = b;
+  ops[nops].arg[2] = c;
+  ops[nops].arg[3] = d;
+  ops[nops].arg[4] = e;
+  nops++;
+}
+
+static int
+fake_watch_fd(void)
+{
+  return -1;
+}
+
+static int
+fake_active_vt(void)
+{
+  return 1;
+}
+
+static int
+fake_text_mode(void)
+{
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  return 1;
+}
+
+static int
+fake_get_size(unsigned int *width, unsigned int *height)
+{
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  *width = 80;
+  *height = 25;
+  return 0;
+}
+
+static int
+fake_get_mouse_reporting(unsigned char *mode)
+{
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  *mode = MOUSE_REPORTING_OFF;
+  return 0;
+}
+
+static int
+fake_set_selection(int xs, int ys, int xe, int ye, int sel_mode)
+{
+  record(FAKE_OP_SELECTION, xs, ys, xe, ye, sel_mode);
+  return 0;
+}
+
+static int
+fake_paste(void)
+{
+  record(FAKE_OP_PASTE, 0, 0, 0, 0, 0);
+  return 0;
+}
+
+static int
+fake_scroll(int sc)
+{
+  record(FAKE_OP_SCROLL, sc, 0, 0, 0, 0);
+  return 0;
+}
+
+static int
+fake_load_lut(const uint32_t *lut)
+{
+  record(FAKE_OP_LOAD_LUT, lut[1], lut[2], lut[3], 0, 0);
+  return 0;
+}
+
+/* Every row reads the same: words, a path, a frame and some CJK text. */
+
+static const uint32_t fake_row[] = {
+  'c','o','n','s','o','l','a','t','i','o','n',' ',' ','/','u','s','r','/',
+  's','h','a','r','e',' ',0x2502,0x2500,0x2500,0x2502,' ',0x65E5,0x672C,
+  0x8A9E,0x3001,0x6587,0x5B57,' ','(','x',')',':',' '
+};
+
+static int
+fake_read_text(unsigned int offset, uint32_t *text, unsigned int count)
+{
+  const unsigned int len = sizeof(fake_row)/sizeof(*fake_row);
+  unsigned int i;
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  if (offset >= 80*25)
+    return 0;
+  if (count > 80*25 - offset)
+    count = 80*25 - offset;
+  for (i = 0; i < count; i++)
+    text[i] = (offset + i) % 80 < len ? fake_row[(offset + i) % 80] : ' ';
+  return count;
+}
+
+static uint16_t screen[80*25];
+static unsigned int printed = 0;
+
+static void
+print_line(uint16_t *row)
+{
+  char text[81];
+  int i;
+  snprintf(text, sizeof(text), "line %u: consolation /usr/share/doc", printed++);
+  for (i = 0; i < 80; i++)
+    row[i] = 0x0700 | (i < (int)strlen(text) ? (unsigned char)text[i] : ' ');
+}
+
+static int
+fake_read_screen(int vt, uint16_t *cells, unsigned int width,
+    unsigned int height)
+{
+  int i;
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  if (width != 80 || height != 25)
+    return -1;
+  if (!printed)
+    for (i = 0; i < 25; i++)
+      print_line(screen + i*80);
+  else
+  {
+    memmove(screen, screen + 80, 24*80*sizeof(*screen));
+    print_line(screen + 24*80);
+  }
+  memcpy(cells, screen, sizeof(screen));
+  return 0;
+}
+
+static int
+fake_write_screen(int vt, unsigned int offset, const uint16_t *cells,
+    unsigned int count)
+{
+  record(FAKE_OP_WRITE_SCREEN, offset, count, 0, 0, 0);
+  if (offset + count > 80*25)
+    return -1;
+  memcpy(screen + offset, cells, count*sizeof(*cells));
+  return 0;
+}
+
+/* The input queue is always empty, as if the application were reading
+   as fast as we type. */
+
+static int
+fake_input_queued(int vt)
+{
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  return 0;
+}
+
+static int
+fake_inject(int vt, const char *text, unsigned int len)
+{
+  record(FAKE_OP_INJECT, vt, len, 0, 0, 0);
+  return len;
+}
+
+static int
+fake_bracketed_paste(void)
+{
+  record(FAKE_OP_QUERY, 0, 0, 0, 0, 0);
+  return 0;
+}
+
+void
+fake_console_report(FILE *f)
+{
+  int i;
+  for (i = 0; i < FAKE_OP_COUNT; i++)
+    fprintf(f, "fake console %s: %lu\n", fake_op_names[i], counts[i]);
+}
+
+static void
+write_trace(FILE *f)
+{
+  size_t i;
+  for (i = 0; i < nops; i++)
+  {
+    int *a = ops[i].arg;
+    switch (ops[i].type)
+    {
+    case FAKE_OP_SELECTION:
+      fprintf(f, "selection %d %d %d %d %d\n", a[0], a[1], a[2], a[3], a[4]);
+      break;
+    case FAKE_OP_SCROLL:
+      fprintf(f, "scroll %d\n", a[0]);
+      break;
+    case FAKE_OP_INJECT:
+      fprintf(f, "inject %d %d\n", a[0], a[1]);
+      break;
+    case FAKE_OP_WRITE_SCREEN:
+      fprintf(f, "write_screen %d %d\n", a[0], a[1]);
+      break;
+    case FAKE_OP_LOAD_LUT:
+      fprintf(f, "load_lut %08x %08x %08x\n", a[0], a[1], a[2]);
+      break;
+    default:
+      fprintf(f, "%s\n", fake_op_names[ops[i].type]);
+      break;
+    }
+  }
+}
+
+static void
+fake_close(void)
+{
+  if (trace_path)
+  {
+    FILE *f = fopen(trace_path, "w");
+    if (!f)
+      perror(trace_path);
+    else
+    {
+      write_trace(f);
+      fclose(f);
+    }
+  }
+  free(ops);
+  ops = NULL;
+  nops = 0;
+}
+
+const struct console_backend fake_console = {
+  "fake",
+  fake_watch_fd,
+  fake_active_vt,
+  fake_text_mode,
+  fake_get_size,
+  fake_get_mouse_reporting,
+  fake_set_selection,
+  fake_paste,
+  fake_scroll,
+  fake_load_lut,
+  fake_read_text,
+  fake_read_screen,
+  fake_write_screen,
+  fake_input_queued,
+  fake_inject,
+  fake_bracketed_paste,
+  fake_close
+};
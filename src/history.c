@@ -0,0 +1,294 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/tiocl.h>
+
+#include "consolation.h"
+#include "protocol.h"
+
+/* Selection history.
+
+   When a selection is complete, its text is read from /dev/vcsu and kept
+   in a ring of the last selections, served on the socket given with
+   --selection-socket and on the control socket. Lines are separated by
+   newlines and their trailing blanks removed, as in the kernel paste
+   buffer. Selecting text again moves its entry to the front instead of
+   storing it twice.
+
+   The text lives in a fixed arena; the entries that are dropped or moved
+   leave holes that are compacted away when the arena is full.
+*/
+
+#define HISTORY_ARENA (256*1024)
+
+struct entry {
+  uint32_t off, len;
+  uint64_t hash;
+};
+
+static struct entry *entries = NULL; /* the oldest first */
+static int max_entries = 0, count = 0;
+static char *arena = NULL;
+static size_t arena_used = 0;
+static struct ipc_server *server = NULL;
+
+static uint64_t
+hash_text(const char *text, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (len--)
+    h = (h ^ (uint8_t)*text++) * 0x100000001b3ULL;
+  return h;
+}
+
+static void
+drop(int i)
+{
+  memmove(entries + i, entries + i + 1, (count - i - 1) * sizeof(*entries));
+  count--;
+}
+
+static void
+compact(void)
+{
+  struct entry *order[count ? count : 1];
+  int i, j;
+  /* sort by offset, so that text only ever moves down */
+  for (i = 0; i < count; i++)
+  {
+    for (j = i; j > 0 && order[j-1]->off > entries[i].off; j--)
+      order[j] = order[j-1];
+    order[j] = &entries[i];
+  }
+  arena_used = 0;
+  for (i = 0; i < count; i++)
+  {
+    memmove(arena + arena_used, arena + order[i]->off, order[i]->len);
+    order[i]->off = arena_used;
+    arena_used += order[i]->len;
+  }
+}
+
+static void
+add(const char *text, size_t len)
+{
+  uint64_t hash = hash_text(text, len);
+  struct entry e;
+  int i;
+  for (i = 0; i < count; i++)
+    if (entries[i].hash == hash && entries[i].len == len
+        && !memcmp(arena + entries[i].off, text, len))
+    {
+      e = entries[i];
+      drop(i);
+      entries[count++] = e;
+      return;
+    }
+  if (count == max_entries)
+    drop(0);
+  if (arena_used + len > HISTORY_ARENA)
+    compact();
+  while (count && arena_used + len > HISTORY_ARENA)
+  {
+    drop(0);
+    compact();
+  }
+  e.off = arena_used;
+  e.len = len;
+  e.hash = hash;
+  memcpy(arena + arena_used, text, len);
+  arena_used += len;
+  entries[count++] = e;
+}
+
+static size_t
+put_utf8(char *s, uint32_t c)
+{
+  if (c < 0x80)
+  {
+    s[0] = c;
+    return 1;
+  }
+  if (c < 0x800)
+  {
+    s[0] = 0xc0 | c >> 6;
+    s[1] = 0x80 | (c & 0x3f);
+    return 2;
+  }
+  if (c < 0x10000)
+  {
+    s[0] = 0xe0 | c >> 12;
+    s[1] = 0x80 | ((c >> 6) & 0x3f);
+    s[2] = 0x80 | (c & 0x3f);
+    return 3;
+  }
+  s[0] = 0xf0 | c >> 18;
+  s[1] = 0x80 | ((c >> 12) & 0x3f);
+  s[2] = 0x80 | ((c >> 6) & 0x3f);
+  s[3] = 0x80 | (c & 0x3f);
+  return 4;
+}
+
+/* Record the text of the current selection, if any. With --threads, the
+   screen is only read once the output thread is idle. */
+
+void
+history_add_selection(void)
+{
+  int xs, ys, xe, ye, mode, y;
+  uint32_t row[screen_width ? screen_width : 1];
+  char *text;
+  size_t len = 0, max;
+  if (!entries || !screen_width || selection_get(&xs, &ys, &xe, &ye, &mode))
+    return;
+  if (ye < ys || (ye == ys && xe < xs))
+  {
+    int t;
+    t = xs; xs = xe; xe = t;
+    t = ys; ys = ye; ye = t;
+  }
+  if (mode == TIOCL_SELLINE)
+  {
+    xs = 1;
+    xe = screen_width;
+  }
+  else if (mode != TIOCL_SELCHAR && mode != TIOCL_SELWORD)
+    return;
+  else if (mode == TIOCL_SELCHAR && xs == xe && ys == ye)
+    return; /* a click, not a selection */
+  if (ys < 1)
+    ys = 1;
+  if (ye > (int)screen_height)
+    ye = screen_height;
+  if (ye < ys || !screen_width)
+    return;
+  max = (size_t)(ye - ys + 1) * (screen_width * 4 + 1);
+  if (max > HISTORY_ARENA)
+    return;
+  text = malloc(max);
+  if (!text)
+    return;
+  queue_drain();
+  for (y = ys; y <= ye; y++)
+  {
+    int a = y == ys ? xs : 1, b = y == ye ? xe : (int)screen_width, i;
+    if (a < 1)
+      a = 1;
+    if (b > (int)screen_width)
+      b = screen_width;
+    if (console_read_row(y, row))
+    {
+      free(text);
+      return;
+    }
+    if (mode == TIOCL_SELWORD)
+    {
+      if (y == ys)
+        a = word_boundary(row, screen_width, a-1, -1) + 1;
+      if (y == ye)
+        b = word_boundary(row, screen_width, b-1, 1) + 1;
+    }
+    if (y < ye || b == (int)screen_width)
+      while (b >= a && (row[b-1] == ' ' || row[b-1] == 0))
+        b--;
+    for (i = a; i <= b; i++)
+      len += put_utf8(text + len, row[i-1]);
+    if (y < ye)
+      text[len++] = '\n';
+  }
+  if (len)
+    add(text, len);
+  free(text);
+}
+
+void
+history_request(struct ipc_client *c, const struct csl_msg *req,
+                const void *payload)
+{
+  uint32_t n;
+  int i;
+  switch (req->type)
+  {
+  case CSL_MSG_HISTORY_COUNT:
+    n = count;
+    ipc_reply(c, req, 0, &n, sizeof(n));
+    break;
+  case CSL_MSG_HISTORY_GET:
+    if (req->length != sizeof(n))
+    {
+      ipc_reply(c, req, EINVAL, NULL, 0);
+      break;
+    }
+    memcpy(&n, payload, sizeof(n));
+    if (n >= (uint32_t)count)
+      ipc_reply(c, req, ENOENT, NULL, 0);
+    else
+    {
+      struct entry *e = &entries[count - 1 - n];
+      ipc_reply(c, req, 0, arena + e->off, e->len);
+    }
+    break;
+  case CSL_MSG_HISTORY_LIST:
+    ipc_reply(c, req, 0, NULL, 0);
+    for (i = count; i-- > 0;)
+    {
+      n = entries[i].len;
+      ipc_reply_append(c, &n, sizeof(n));
+      ipc_reply_append(c, arena + entries[i].off, n);
+    }
+    break;
+  default:
+    ipc_reply(c, req, EINVAL, NULL, 0);
+    break;
+  }
+}
+
+/* Keep the last max selections, and serve them on path if not NULL. */
+
+int
+history_init(const char *path, int max)
+{
+  if (max <= 0)
+    return 0;
+  entries = malloc(max * sizeof(*entries));
+  arena = malloc(HISTORY_ARENA);
+  if (!entries || !arena)
+    return 1;
+  max_entries = max;
+  if (!path)
+    return 0;
+  server = ipc_listen(path, history_request);
+  return server ? 0 : 1;
+}
+
+void
+history_close(void)
+{
+  ipc_close(server);
+  server = NULL;
+  free(entries);
+  free(arena);
+  entries = NULL;
+  arena = NULL;
+  count = 0;
+  arena_used = 0;
+}
@@ -0,0 +1,294 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+#include "protocol.h"
+
+/* Bulk paste.
+
+   Text received on the control socket is typed into the foreground VT
+   with TIOCSTI. The tty input queue only holds 4 KiB and what does not
+   fit is dropped, so the text is streamed in chunks while the queue,
+   as reported by FIONREAD, stays under INJECT_HIGH bytes. When it is
+   full, the pipeline backs off on a timer, from 0.5 ms up to 50 ms, until
+   the application reads its input. At most INJECT_ROUND bytes are typed
+   per wakeup so that input events are still handled during a long paste.
+
+   Like the kernel paste, newlines are typed as carriage returns. If the
+   application asked for bracketed paste, and the kernel can tell us, the
+   text is framed with ESC [200~ and ESC [201~, and escape characters are
+   removed from it.
+
+   In canonical mode, FIONREAD only counts complete lines: lines longer
+   than the input queue are truncated by the kernel.
+*/
+
+#define INJECT_MAX   (1024*1024) /* text waiting to be typed */
+#define INJECT_HIGH  2048
+#define INJECT_ROUND 4096
+#define BACKOFF_MIN  500    /* usec */
+#define BACKOFF_MAX  50000  /* usec */
+#define MORE_TIMEOUT 5000000 /* usec to wait for the rest of a paste */
+
+static char *text = NULL;
+static size_t len = 0, off = 0;
+static int vt = 0;          /* VT of the paste in progress, or 0 */
+static int bracketed = 0;
+static int more = 0;        /* more text of the same paste is expected */
+static const struct ipc_client *owner = NULL; /* the client sending it */
+static int timer_fd = -1;
+static long backoff = 0;
+
+static unsigned long inject_pastes = 0;
+static unsigned long inject_bytes = 0;
+static unsigned long inject_backoffs = 0;
+static unsigned long inject_dropped = 0;
+static uint64_t inject_time = 0;  /* nsec spent with a paste in progress */
+static uint64_t started = 0;
+
+static void
+arm(long usec)
+{
+  struct itimerspec its = {{0, 0}, {usec/1000000, (usec%1000000)*1000}};
+  if (timerfd_settime(timer_fd, 0, &its, NULL))
+    perror("timerfd_settime");
+}
+
+static void
+append(const char *s, size_t n)
+{
+  memcpy(text + len, s, n);
+  len += n;
+}
+
+static void
+finish(void)
+{
+  inject_time += now_nsec() - started;
+  len = off = 0;
+  vt = 0;
+  more = 0;
+  owner = NULL;
+  backoff = 0;
+}
+
+static void
+back_off(void)
+{
+  backoff = backoff ? backoff * 2 : BACKOFF_MIN;
+  if (backoff > BACKOFF_MAX)
+    backoff = BACKOFF_MAX;
+  inject_backoffs++;
+  arm(backoff);
+}
+
+static void
+pump(void)
+{
+  size_t round = 0;
+  while (off < len && round < INJECT_ROUND)
+  {
+    int queued = console->input_queued(vt), n;
+    size_t room;
+    if (queued < 0 && errno == EAGAIN)
+    {
+      /* the console is busy with another operation */
+      back_off();
+      return;
+    }
+    if (queued < 0)
+    {
+      perror("paste: FIONREAD");
+      inject_dropped += len - off;
+      finish();
+      return;
+    }
+    if (queued >= INJECT_HIGH)
+    {
+      back_off();
+      return;
+    }
+    room = INJECT_HIGH - queued;
+    if (room > len - off)
+      room = len - off;
+    n = console->inject(vt, text + off, room);
+    if (n < 0 && errno == EAGAIN)
+    {
+      back_off();
+      return;
+    }
+    if (n < 0)
+    {
+      perror("paste: TIOCSTI");
+      inject_dropped += len - off;
+      finish();
+      return;
+    }
+    backoff = 0;
+    off += n;
+    round += n;
+    inject_bytes += n;
+  }
+  if (off < len)
+    arm(1); /* let the main loop run */
+  else if (more)
+    arm(MORE_TIMEOUT);
+  else
+    finish();
+}
+
+static void
+inject_timer(int fd, uint32_t events, void *data)
+{
+  uint64_t expirations;
+  if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+    return;
+  if (vt && off == len && more)
+  {
+    /* the client went away in the middle of the paste */
+    more = 0;
+    owner = NULL;
+    if (bracketed)
+      append("\033[201~", 6);
+  }
+  if (vt)
+    pump();
+}
+
+/* End the paste that c was sending, as c is disconnecting. */
+
+void
+inject_detach(const struct ipc_client *c)
+{
+  if (!vt || !more || owner != c)
+    return;
+  more = 0;
+  owner = NULL;
+  if (bracketed)
+    append("\033[201~", 6);
+  arm(1);
+}
+
+int
+inject_init(void)
+{
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (timer_fd == -1)
+  {
+    perror("timerfd_create");
+    return 1;
+  }
+  if (!loop_add(timer_fd, EPOLLIN, inject_timer, NULL))
+    return 1;
+  return 0;
+}
+
+/* Queue s, sent by client c, for typing into the foreground VT; with
+   CSL_PASTE_CONTINUE, the next call from c continues the same paste, and
+   other clients get EBUSY until it ends. Return 0 or an errno value. */
+
+int
+inject_text(const struct ipc_client *c, const char *s, size_t n,
+            unsigned int flags)
+{
+  size_t i;
+  if (!text && !(text = malloc(INJECT_MAX)))
+    return ENOMEM;
+  if (vt && (!more || owner != c))
+    return EBUSY;
+  if (off)
+  {
+    memmove(text, text + off, len - off);
+    len -= off;
+    off = 0;
+  }
+  if (len + n + 12 > INJECT_MAX)
+    return ENOBUFS;
+  if (!vt)
+  {
+    console_update_state();
+    if (!console_text_mode() || !console_active_vt)
+      return EIO;
+    vt = console_active_vt;
+    bracketed = flags & CSL_PASTE_BRACKETED
+        || (!(flags & CSL_PASTE_RAW) && console->bracketed_paste() == 1);
+    if (bracketed)
+      append("\033[200~", 6);
+    inject_pastes++;
+    started = now_nsec();
+  }
+  for (i = 0; i < n; i++)
+    if (s[i] == '\n')
+      text[len++] = '\r';
+    else if (s[i] != '\033' || !bracketed)
+      text[len++] = s[i];
+  more = flags & CSL_PASTE_CONTINUE;
+  owner = more ? c : NULL;
+  if (!more && bracketed)
+    append("\033[201~", 6);
+  pump();
+  return 0;
+}
+
+/* Type a short sequence, such as a mouse report, at once. It is not
+   typed during a bulk paste, which it would corrupt. Return 0 or an
+   errno value. */
+
+int
+inject_sequence(const char *s, size_t n)
+{
+  uint64_t t;
+  int err;
+  if (vt)
+    return EBUSY;
+  if (!console_active_vt)
+    return EIO;
+  t = metrics_start();
+  err = console->inject(console_active_vt, s, n) != (int)n;
+  metrics_op(METRIC_OP_TIOCSTI, t, err);
+  return err ? EIO : 0;
+}
+
+void
+inject_report(FILE *f)
+{
+  double secs = (inject_time + (vt ? now_nsec() - started : 0)) / 1e9;
+  if (!inject_pastes)
+    return;
+  fprintf(f, "bulk paste: %lu pastes, %lu bytes, %.0f bytes/s, %lu backoffs, "
+      "%lu bytes dropped\n", inject_pastes, inject_bytes,
+      secs > 0 ? inject_bytes / secs : 0, inject_backoffs, inject_dropped);
+}
+
+void
+inject_close(void)
+{
+  if (timer_fd != -1)
+    close(timer_fd);
+  timer_fd = -1;
+  free(text);
+  text = NULL;
+}
@@ -25,207 +25,1033 @@
 
 
 #define _GNU_SOURCE
+#include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
 #include <linux/input.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include <libinput.h>
+#include <libudev.h>
 #include "config.h"
 #include "shared.h"
 #include "consolation.h"
+#include "protocol.h"
 
 
 int nodaemon = false;
+int scroll_lines = 2;
+int threaded = false;
 unsigned int screen_width;
 unsigned int screen_height;
 enum mouse_reporting_mode mouse_reporting = MOUSE_REPORTING_OFF;
+enum mouse_encoding mouse_encoding = MOUSE_ENCODING_KERNEL;
+enum mouse_motion mouse_motion = MOUSE_MOTION_NONE;
 
 static struct tools_options options;
-static unsigned int stop = 0;
 static enum tools_backend backend = BACKEND_UDEV;
 static const char *seat_or_device = "seat0";
 static bool grab = false;
 static bool verbose = false;
 static const char *word_chars = NULL;
+static const char *config_file = NULL;
+static int max_fps = 0;
+static const char *selection_socket = NULL;
+static int selection_history = 16;
+static const char *control_socket = NULL;
+static long scrollback_kb = 0;
+static long scrollback_interval = 250;
+static const char *fake_trace = NULL;
+static long fake_latency = 0;
+static int realtime_priority = 0;
+static cpu_set_t cpu_affinity;
+static bool cpu_affinity_set = false;
+static const char *record_file = NULL;
+static const char *replay_file = NULL;
+
+/* Motion events are not rendered one by one: all the motion drained in
+   one call to handle_events() is accumulated in the seat and rendered
+   once, either at the end of the batch or just before any other event,
+   so that buttons still act at the exact pointer position. */
+
+/* Likewise, scrolling is summed over the batch, in 1/120 of a wheel
+   detent. For finger and continuous scrolling, 15 units of libinput
+   (the angle of a typical detent) count as one detent; these are summed
+   exactly, and the fraction of 1/120 left at the end of the batch is
+   carried over, so that slow scrolling still adds up. */
+
+static void
+flush_axis(struct seat *s)
+{
+  int rest = (int)s->axis_rest;
+  s->axis_rest -= rest;
+  s->axis_v120 += rest;
+  if (s->axis_v120)
+    vertical_axis(s, s->axis_v120);
+  s->axis_v120 = 0;
+}
 
 static void
-handle_motion_event(struct libinput_event *ev)
+set_motion(struct seat *s, double x, double y)
 {
-  struct libinput_event_pointer *p = libinput_event_get_pointer_event(ev);
-  double x = libinput_event_pointer_get_dx(p);
-  double y = libinput_event_pointer_get_dy(p);
-  move_pointer(x, y);
+  /* An absolute position overrides any relative motion before it */
+  s->motion.x = x; s->motion.y = y;
+  s->motion.absolute = 1;
+  s->motion.dx = s->motion.dy = 0;
+  s->motion.relative = 0;
 }
 
 static void
-handle_absmotion_event(struct libinput_event *ev)
+flush_motion(struct seat *s)
 {
-  struct libinput_event_pointer *p = libinput_event_get_pointer_event(ev);
-  double x = libinput_event_pointer_get_absolute_x_transformed(p, screen_width);
-  double y = libinput_event_pointer_get_absolute_y_transformed(p, screen_height);
-  set_pointer(x, y);
+  if (s->motion.absolute)
+    set_pointer(s, s->motion.x, s->motion.y);
+  if (s->motion.relative)
+    move_pointer(s, s->motion.dx, s->motion.dy);
+  s->motion.absolute = s->motion.relative = 0;
+  s->motion.dx = s->motion.dy = 0;
+}
+
+/* The handle_* functions work on struct csl_event rather than on libinput
+   events, so that recorded events can be replayed through them. */
+
+static void
+handle_motion_event(struct seat *s, const struct csl_event *e)
+{
+  s->motion.dx += e->x;
+  s->motion.dy += e->y;
+  s->motion.relative = 1;
 }
 
 static void
-handle_pointer_button_event(struct libinput_event *ev)
-{
-  struct libinput_event_pointer *p = libinput_event_get_pointer_event(ev);
-  enum libinput_button_state state;
-  int button;
-  button = libinput_event_pointer_get_button(p);
-  state = libinput_event_pointer_get_button_state(p);
-  switch(button)
+handle_absmotion_event(struct seat *s, const struct csl_event *e)
+{
+  set_motion(s, e->x * screen_width, e->y * screen_height);
+}
+
+static void
+handle_pointer_button_event(struct seat *s, const struct csl_event *e)
+{
+  switch(e->code)
   {
   case BTN_LEFT:
-    if (state==LIBINPUT_BUTTON_STATE_PRESSED)
-      press_left_button();
+    if (e->state==LIBINPUT_BUTTON_STATE_PRESSED)
+      press_left_button(s);
     else
-      release_left_button();
+      release_left_button(s);
     break;
   case BTN_MIDDLE:
-    if (state==LIBINPUT_BUTTON_STATE_PRESSED)
-      press_middle_button();
+    if (e->state==LIBINPUT_BUTTON_STATE_PRESSED)
+      press_middle_button(s);
     else
-      release_middle_button();
+      release_middle_button(s);
     break;
   case BTN_RIGHT:
-    if (state==LIBINPUT_BUTTON_STATE_PRESSED)
-      press_right_button();
+    if (e->state==LIBINPUT_BUTTON_STATE_PRESSED)
+      press_right_button(s);
     else
-      release_right_button();
+      release_right_button(s);
     break;
   }
 }
 
 static void
-handle_pointer_axis_event(struct libinput_event *ev)
+handle_pointer_axis_event(struct seat *s, const struct csl_event *e)
 {
-  struct libinput_event_pointer *p = libinput_event_get_pointer_event(ev);
-  double v = 0;
-  if (libinput_event_pointer_has_axis(p,
-        LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL))
+  if (!(e->code & CSL_AXIS_VERTICAL))
+    return;
+  if (e->state == LIBINPUT_POINTER_AXIS_SOURCE_FINGER)
   {
-    v = libinput_event_pointer_get_axis_value(p,
-        LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
-    vertical_axis(v);
+    /* a zero value marks the end of the scroll sequence */
+    if (e->x)
+      kinetic_sample(s, e->time, e->x);
+    else
+      kinetic_release(s, e->time);
   }
+  else
+    kinetic_cancel(s);
+  if (e->state == LIBINPUT_POINTER_AXIS_SOURCE_WHEEL && e->value)
+    s->axis_v120 += e->value;
+  else
+    s->axis_rest += e->x * 8;
+}
+
+/* Touchscreens.
+
+   Every slot is tracked, but the selection only follows the first finger
+   down (the primary slot), and the pointer is only moved once per
+   TOUCH_FRAME, whatever the number of slots that moved in the frame.
+
+   As a click would replace the paste buffer, the primary finger only
+   presses the button once it moved by a cell or stayed down for
+   TOUCH_DELAY; a second finger down before that turns the gesture into
+   a two-finger one: a drag scrolls, with kinetic scrolling on release,
+   and a tap shorter than TAP_TIME pastes. A third finger cancels it. */
+
+#define TOUCH_DELAY 100000 /* usec */
+#define TAP_TIME    300000 /* usec */
+
+enum {
+  TOUCH_IDLE,    /* no finger down */
+  TOUCH_PENDING, /* one finger down, not pressed yet */
+  TOUCH_SELECT,  /* the primary finger holds the left button */
+  TOUCH_TWO,     /* two fingers down, not moved yet */
+  TOUCH_SCROLL,  /* two-finger drag */
+  TOUCH_DONE     /* gesture over, waiting for all fingers up */
+};
+
+static struct touch *
+touch_slot(struct seat *s, const struct csl_event *e)
+{
+  /* single touch devices have no slot */
+  int slot = e->value < 0 ? 0 : e->value;
+  return slot < MAX_TOUCH_SLOTS ? &s->touch[slot] : NULL;
+}
+
+/* Mean vertical position of the fingers down, in rows */
+static double
+touch_rows(struct seat *s)
+{
+  double y = 0;
+  int i, n = 0;
+  for (i = 0; i < MAX_TOUCH_SLOTS; i++)
+    if (s->touch[i].down)
+    {
+      y += s->touch[i].y;
+      n++;
+    }
+  return n ? y / n : 0;
 }
 
 static void
-handle_touch_event_down(struct libinput_event *ev)
+handle_touch_event_down(struct seat *s, const struct csl_event *e)
 {
-  struct libinput_event_touch *t = libinput_event_get_touch_event(ev);
-  double x = libinput_event_touch_get_x_transformed(t, screen_width);
-  double y = libinput_event_touch_get_y_transformed(t, screen_height);
-  set_pointer(x, y);
-  press_left_button();
+  struct touch *t = touch_slot(s, e);
+  if (!t || t->down)
+    return;
+  t->down = 1;
+  t->x = e->x * screen_width;
+  t->y = e->y * screen_height;
+  if (!s->touches)
+  {
+    s->gesture = TOUCH_PENDING;
+    s->primary = t - s->touch;
+    s->touch_x0 = t->x;
+    s->touch_y0 = t->y;
+    s->touch_time = e->time;
+  }
+  else if (s->gesture == TOUCH_PENDING)
+  {
+    s->gesture = TOUCH_TWO;
+    s->scroll_y = touch_rows(s);
+  }
+  else if (s->gesture == TOUCH_TWO || s->gesture == TOUCH_SCROLL)
+  {
+    kinetic_cancel(s);
+    s->gesture = TOUCH_DONE;
+  }
+  s->touches++;
 }
 
 static void
-handle_touch_event_motion(struct libinput_event *ev)
+handle_touch_event_motion(struct seat *s, const struct csl_event *e)
 {
-  struct libinput_event_touch *t = libinput_event_get_touch_event(ev);
-  double x = libinput_event_touch_get_x_transformed(t, screen_width);
-  double y = libinput_event_touch_get_y_transformed(t, screen_height);
-  set_pointer(x, y);
+  struct touch *t = touch_slot(s, e);
+  if (!t || !t->down)
+    return;
+  t->x = e->x * screen_width;
+  t->y = e->y * screen_height;
 }
 
 static void
-handle_touch_event_up(struct libinput_event *ev)
+handle_touch_event_up(struct seat *s, const struct csl_event *e)
 {
-  release_left_button();
+  struct touch *t = touch_slot(s, e);
+  if (!t || !t->down)
+    return;
+  t->down = 0;
+  s->touches--;
+  switch (s->gesture)
+  {
+  case TOUCH_PENDING:
+    /* a tap: click where the finger landed */
+    set_motion(s, s->touch_x0, s->touch_y0);
+    flush_motion(s);
+    press_left_button(s);
+    release_left_button(s);
+    s->gesture = TOUCH_DONE;
+    break;
+  case TOUCH_SELECT:
+    if (t - s->touch != s->primary)
+      break;
+    set_motion(s, t->x, t->y);
+    flush_motion(s);
+    release_left_button(s);
+    s->gesture = TOUCH_DONE;
+    break;
+  case TOUCH_TWO:
+    if (e->time < s->touch_time + TAP_TIME)
+    {
+      press_middle_button(s);
+      release_middle_button(s);
+    }
+    s->gesture = TOUCH_DONE;
+    break;
+  case TOUCH_SCROLL:
+    kinetic_release(s, e->time);
+    s->gesture = TOUCH_DONE;
+    break;
+  }
+  if (!s->touches)
+    s->gesture = TOUCH_IDLE;
+}
+
+/* The touches were taken over, e.g. by palm rejection: forget them all */
+static void
+handle_touch_event_cancel(struct seat *s, const struct csl_event *e)
+{
+  if (s->gesture == TOUCH_SELECT)
+    release_left_button(s);
+  else if (s->gesture == TOUCH_SCROLL)
+    kinetic_cancel(s);
+  memset(s->touch, 0, sizeof(s->touch));
+  s->touches = 0;
+  s->gesture = TOUCH_IDLE;
 }
 
+static void
+handle_touch_event_frame(struct seat *s, const struct csl_event *e)
+{
+  struct touch *p = &s->touch[s->primary];
+  double rows, units;
+
+  switch (s->gesture)
+  {
+  case TOUCH_PENDING:
+    if (fabs(p->x - s->touch_x0) >= 1 || fabs(p->y - s->touch_y0) >= 1
+        || e->time >= s->touch_time + TOUCH_DELAY)
+    {
+      set_motion(s, s->touch_x0, s->touch_y0);
+      flush_motion(s);
+      press_left_button(s);
+      s->gesture = TOUCH_SELECT;
+    }
+    set_motion(s, p->x, p->y);
+    break;
+  case TOUCH_SELECT:
+    set_motion(s, p->x, p->y);
+    break;
+  case TOUCH_TWO:
+  case TOUCH_SCROLL:
+    rows = touch_rows(s) - s->scroll_y;
+    if (s->gesture == TOUCH_TWO && fabs(rows) < 1)
+      break;
+    s->gesture = TOUCH_SCROLL;
+    s->scroll_y += rows;
+    /* the content follows the fingers; 15 units scroll scroll_lines */
+    units = -rows * 15 / scroll_lines;
+    kinetic_sample(s, e->time, units);
+    s->axis_rest += units * 8;
+    break;
+  }
+}
+
+void
+input_dispatch(struct seat *s, const struct csl_event *e)
+{
+  if (e->type > CSL_EVENT_TOUCH_CANCEL)
+    return;
+  metrics_events[e->type]++;
+  if (e->type != CSL_EVENT_MOTION
+      && e->type != CSL_EVENT_MOTION_ABSOLUTE
+      && e->type != CSL_EVENT_TOUCH_DOWN
+      && e->type != CSL_EVENT_TOUCH_MOTION
+      && e->type != CSL_EVENT_TOUCH_UP
+      && e->type != CSL_EVENT_AXIS)
+  {
+    flush_motion(s);
+    flush_axis(s);
+    schedule_flush();
+  }
+  if (e->type == CSL_EVENT_BUTTON || e->type == CSL_EVENT_TOUCH_DOWN)
+    kinetic_cancel(s);
+  switch (e->type) {
+  case CSL_EVENT_MOTION:
+    handle_motion_event(s, e);
+    break;
+  case CSL_EVENT_MOTION_ABSOLUTE:
+    handle_absmotion_event(s, e);
+    break;
+  case CSL_EVENT_BUTTON:
+    handle_pointer_button_event(s, e);
+    break;
+  case CSL_EVENT_AXIS:
+    handle_pointer_axis_event(s, e);
+    break;
+  case CSL_EVENT_TOUCH_DOWN:
+    handle_touch_event_down(s, e);
+    break;
+  case CSL_EVENT_TOUCH_MOTION:
+    handle_touch_event_motion(s, e);
+    break;
+  case CSL_EVENT_TOUCH_UP:
+    handle_touch_event_up(s, e);
+    break;
+  case CSL_EVENT_TOUCH_FRAME:
+    handle_touch_event_frame(s, e);
+    break;
+  case CSL_EVENT_TOUCH_CANCEL:
+    handle_touch_event_cancel(s, e);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Translate a libinput event; return 0 for the events we do not use */
 static int
-handle_events(struct libinput *li)
+translate_event(struct libinput_event *ev, struct csl_event *e)
+{
+  struct libinput_event_pointer *p;
+  struct libinput_event_touch *t;
+
+  memset(e, 0, sizeof(*e));
+  switch (libinput_event_get_type(ev)) {
+  case LIBINPUT_EVENT_POINTER_MOTION:
+    p = libinput_event_get_pointer_event(ev);
+    e->type = CSL_EVENT_MOTION;
+    e->time = libinput_event_pointer_get_time_usec(p);
+    e->x = libinput_event_pointer_get_dx(p);
+    e->y = libinput_event_pointer_get_dy(p);
+    break;
+  case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+    p = libinput_event_get_pointer_event(ev);
+    e->type = CSL_EVENT_MOTION_ABSOLUTE;
+    e->time = libinput_event_pointer_get_time_usec(p);
+    e->x = libinput_event_pointer_get_absolute_x_transformed(p, 1);
+    e->y = libinput_event_pointer_get_absolute_y_transformed(p, 1);
+    break;
+  case LIBINPUT_EVENT_POINTER_BUTTON:
+    p = libinput_event_get_pointer_event(ev);
+    e->type = CSL_EVENT_BUTTON;
+    e->time = libinput_event_pointer_get_time_usec(p);
+    e->code = libinput_event_pointer_get_button(p);
+    e->state = libinput_event_pointer_get_button_state(p);
+    break;
+#ifdef HAVE_LIBINPUT_SCROLL_EVENTS
+  /* LIBINPUT_EVENT_POINTER_AXIS duplicates these and is ignored */
+  case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+  case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+  case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+    p = libinput_event_get_pointer_event(ev);
+    e->type = CSL_EVENT_AXIS;
+    e->time = libinput_event_pointer_get_time_usec(p);
+    switch (libinput_event_get_type(ev)) {
+    case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+      e->state = LIBINPUT_POINTER_AXIS_SOURCE_WHEEL;
+      break;
+    case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+      e->state = LIBINPUT_POINTER_AXIS_SOURCE_FINGER;
+      break;
+    default:
+      e->state = LIBINPUT_POINTER_AXIS_SOURCE_CONTINUOUS;
+      break;
+    }
+    if (libinput_event_pointer_has_axis(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL))
+    {
+      e->code |= CSL_AXIS_VERTICAL;
+      e->x = libinput_event_pointer_get_scroll_value(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+      if (e->state == LIBINPUT_POINTER_AXIS_SOURCE_WHEEL)
+        e->value = libinput_event_pointer_get_scroll_value_v120(p,
+            LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+    }
+    if (libinput_event_pointer_has_axis(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL))
+    {
+      e->code |= CSL_AXIS_HORIZONTAL;
+      e->y = libinput_event_pointer_get_scroll_value(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL);
+    }
+    break;
+#else
+  case LIBINPUT_EVENT_POINTER_AXIS:
+    p = libinput_event_get_pointer_event(ev);
+    e->type = CSL_EVENT_AXIS;
+    e->time = libinput_event_pointer_get_time_usec(p);
+    e->state = libinput_event_pointer_get_axis_source(p);
+    if (libinput_event_pointer_has_axis(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL))
+    {
+      e->code |= CSL_AXIS_VERTICAL;
+      e->x = libinput_event_pointer_get_axis_value(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+      if (e->state == LIBINPUT_POINTER_AXIS_SOURCE_WHEEL)
+        e->value = 120 * libinput_event_pointer_get_axis_value_discrete(p,
+            LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+    }
+    if (libinput_event_pointer_has_axis(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL))
+    {
+      e->code |= CSL_AXIS_HORIZONTAL;
+      e->y = libinput_event_pointer_get_axis_value(p,
+          LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL);
+    }
+    break;
+#endif
+  case LIBINPUT_EVENT_TOUCH_DOWN:
+  case LIBINPUT_EVENT_TOUCH_MOTION:
+    t = libinput_event_get_touch_event(ev);
+    e->type = libinput_event_get_type(ev) == LIBINPUT_EVENT_TOUCH_DOWN ?
+      CSL_EVENT_TOUCH_DOWN : CSL_EVENT_TOUCH_MOTION;
+    e->time = libinput_event_touch_get_time_usec(t);
+    e->value = libinput_event_touch_get_slot(t);
+    e->x = libinput_event_touch_get_x_transformed(t, 1);
+    e->y = libinput_event_touch_get_y_transformed(t, 1);
+    break;
+  case LIBINPUT_EVENT_TOUCH_UP:
+    t = libinput_event_get_touch_event(ev);
+    e->type = CSL_EVENT_TOUCH_UP;
+    e->time = libinput_event_touch_get_time_usec(t);
+    e->value = libinput_event_touch_get_slot(t);
+    break;
+  case LIBINPUT_EVENT_TOUCH_FRAME:
+    t = libinput_event_get_touch_event(ev);
+    e->type = CSL_EVENT_TOUCH_FRAME;
+    e->time = libinput_event_touch_get_time_usec(t);
+    break;
+  case LIBINPUT_EVENT_TOUCH_CANCEL:
+    t = libinput_event_get_touch_event(ev);
+    e->type = CSL_EVENT_TOUCH_CANCEL;
+    e->time = libinput_event_touch_get_time_usec(t);
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+void
+input_flush(struct seat *s)
+{
+  flush_motion(s);
+  flush_axis(s);
+}
+
+/* Keyboards and other devices that cannot move the pointer would wake us
+   up for every event. They are removed from path contexts and disabled
+   in udev contexts, which closes them. */
+static void
+ignore_device(struct libinput_device *device)
+{
+  if (verbose)
+    fprintf(stderr, "ignoring device %s\n", libinput_device_get_name(device));
+  if (backend == BACKEND_DEVICE)
+    libinput_path_remove_device(device);
+  else if (libinput_device_config_send_events_get_modes(device) &
+           LIBINPUT_CONFIG_SEND_EVENTS_DISABLED)
+    libinput_device_config_send_events_set_mode(device,
+        LIBINPUT_CONFIG_SEND_EVENTS_DISABLED);
+}
+
+/* The devices in use, so that a new configuration can be applied to them
+   without enumerating them again. */
+
+static struct libinput_device **devices = NULL;
+static size_t ndevices = 0, devices_alloc = 0;
+
+static void
+track_device(struct libinput_device *device)
+{
+  if (ndevices == devices_alloc)
+  {
+    size_t alloc = devices_alloc ? 2 * devices_alloc : 16;
+    struct libinput_device **d = realloc(devices, alloc * sizeof(*d));
+    if (!d)
+      return;
+    devices = d;
+    devices_alloc = alloc;
+  }
+  devices[ndevices++] = libinput_device_ref(device);
+}
+
+static void
+untrack_device(struct libinput_device *device)
+{
+  size_t i;
+  for (i = 0; i < ndevices; i++)
+    if (devices[i] == device)
+    {
+      libinput_device_unref(device);
+      devices[i] = devices[--ndevices];
+      return;
+    }
+}
+
+static void
+untrack_devices(void)
+{
+  while (ndevices)
+    libinput_device_unref(devices[--ndevices]);
+  free(devices);
+  devices = NULL;
+  devices_alloc = 0;
+}
+
+static int
+handle_events(struct seat *s)
 {
   int rc = -1;
   struct libinput_event *ev;
+  struct csl_event e;
 
-  libinput_dispatch(li);
-  set_screen_size_and_mouse_reporting();
-  while ((ev = libinput_get_event(li))) {
+  libinput_dispatch(s->li);
+  console_update_state();
+  while ((ev = libinput_get_event(s->li))) {
 
     switch (libinput_event_get_type(ev)) {
     case LIBINPUT_EVENT_NONE:
       abort();
     case LIBINPUT_EVENT_DEVICE_ADDED:
-    case LIBINPUT_EVENT_DEVICE_REMOVED:
+      metrics_events[METRIC_EVENT_DEVICE_ADDED]++;
+      if (!tools_device_wanted(libinput_event_get_device(ev), &options))
+      {
+        ignore_device(libinput_event_get_device(ev));
+        break;
+      }
       tools_device_apply_config(libinput_event_get_device(ev),
           &options);
+      track_device(libinput_event_get_device(ev));
       break;
-    case LIBINPUT_EVENT_POINTER_MOTION:
-      handle_motion_event(ev);
-      break;
-    case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
-      handle_absmotion_event(ev);
-      break;
-    case LIBINPUT_EVENT_POINTER_BUTTON:
-      handle_pointer_button_event(ev);
-      break;
-    case LIBINPUT_EVENT_POINTER_AXIS:
-      handle_pointer_axis_event(ev);
-      break;
-    case LIBINPUT_EVENT_TOUCH_DOWN:
-      handle_touch_event_down(ev);
-      break;
-    case LIBINPUT_EVENT_TOUCH_MOTION:
-      handle_touch_event_motion(ev);
-      break;
-    case LIBINPUT_EVENT_TOUCH_UP:
-      handle_touch_event_up(ev);
+    case LIBINPUT_EVENT_DEVICE_REMOVED:
+      metrics_events[METRIC_EVENT_DEVICE_REMOVED]++;
+      untrack_device(libinput_event_get_device(ev));
+      tools_device_apply_config(libinput_event_get_device(ev),
+          &options);
       break;
     default:
+      if (translate_event(ev, &e))
+      {
+        if (record_file)
+          record_event(&e);
+        metrics_input(e.time);
+        input_dispatch(s, &e);
+      }
+      else
+        metrics_events[METRIC_EVENT_OTHER]++;
       break;
     }
     libinput_event_destroy(ev);
-    libinput_dispatch(li);
+    libinput_dispatch(s->li);
     rc = 0;
   }
+  if (record_file)
+    record_sync();
+  input_flush(s);
+  if (!s->render_pending)
+    metrics_input_clear();
+  return rc;
+}
+
+/* While the foreground VT is in graphics mode (X, a Wayland compositor),
+   or does not belong to the seat, the devices of the seat are closed
+   with libinput_suspend(), so that the daemon does not wake up at all.
+   The mode is checked again on VT switches, and, as the mode may also
+   change without a VT switch, every RECHECK_INTERVAL seconds while in
+   graphics mode.  Without a way to watch VT switches, the timer also
+   keeps running while any seat is suspended, and the active VT is
+   polled too. */
+
+#define RECHECK_INTERVAL 2
+
+static int recheck_fd = -1;
+static int rechecking = 0;
+static int watching_vt = 0;
+
+static void
+set_recheck_timer(int on)
+{
+  struct itimerspec its = {{on ? RECHECK_INTERVAL : 0, 0},
+                           {on ? RECHECK_INTERVAL : 0, 0}};
+  if (on == rechecking)
+    return;
+  if (recheck_fd != -1 && timerfd_settime(recheck_fd, 0, &its, NULL))
+    perror("timerfd_settime");
+  rechecking = on;
+}
+
+static void
+update_suspension(struct seat *s)
+{
+  int text = console_text_mode();
+  int active = text && seat_active(s);
+  if (!active && !s->suspended)
+  {
+    if (verbose)
+      fprintf(stderr, "%s: %s, suspending input\n", s->name,
+              text ? "VT not on seat" : "graphics mode");
+    input_flush(s);
+    kinetic_cancel(s);
+    memset(s->touch, 0, sizeof(s->touch));
+    s->touches = 0;
+    s->gesture = TOUCH_IDLE;
+    libinput_suspend(s->li);
+    s->suspended = 1;
+  }
+  else if (active && s->suspended)
+  {
+    if (verbose)
+      fprintf(stderr, "%s: text mode, resuming input\n", s->name);
+    if (libinput_resume(s->li))
+      fprintf(stderr, "Failed to resume input\n");
+    s->suspended = 0;
+  }
+}
+
+static void
+update_recheck_timer(void)
+{
+  int i, on = !console_text_mode();
+  for (i = 0; !on && !watching_vt && i < nseats; i++)
+    on = seats[i].suspended;
+  set_recheck_timer(on);
+}
+
+static void
+update_seats(void)
+{
+  int i;
+  for (i = 0; i < nseats; i++)
+    update_suspension(&seats[i]);
+  update_recheck_timer();
+}
+
+static void
+libinput_ready(int fd, uint32_t events, void *data)
+{
+  handle_events(data);
+  update_suspension(data);
+  update_recheck_timer();
+}
+
+static void
+vt_changed(int fd, uint32_t events, void *data)
+{
+  console_vt_changed();
+  update_seats();
+}
+
+static void
+recheck_mode(int fd, uint32_t events, void *data)
+{
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) < 0)
+    return;
+  if (!watching_vt)
+    console_vt_changed();
+  update_seats();
+}
+
+/* Parse a decimal integer from min to max */
+static int
+parse_number(const char *arg, long min, long max, long *v)
+{
+  char *end;
+  errno = 0;
+  *v = strtol(arg, &end, 10);
+  if (end == arg || *end || errno || *v < min || *v > max)
+    return -1;
+  return 0;
+}
+
+/* Configuration file.
+
+   Each line of the file given with --config is the long name of an
+   option, without the leading dashes, and its value if any, as in
+   "enable-tap" or "word-chars=a-z0-9_". Only the device settings,
+   word-chars and scroll-lines may be set there. They take precedence
+   over the command line, and the file is read again on SIGHUP and
+   whenever it is written to: only the settings that changed are then
+   applied to the devices in use, and the LUT is only loaded again if
+   the word characters changed. Changes to the device selection
+   (--match-name, --match-udev-property, --all-devices) need a restart.
+*/
+
+enum {
+  CONFIG_WORD_CHARS = 1,
+  CONFIG_SCROLL_LINES
+};
+
+static const struct option config_opts[] = {
+  CONFIGURATION_OPTIONS,
+  { "word-chars",                required_argument, 0, CONFIG_WORD_CHARS },
+  { "scroll-lines",              required_argument, 0, CONFIG_SCROLL_LINES },
+  { 0, 0, 0, 0}
+};
+
+/* Settings from the command line, on top of which the file is applied */
+static struct tools_options base_options;
+static const char *base_word_chars;
+static int base_scroll_lines;
+static char *file_word_chars = NULL;
+static int inotify_fd = -1;
+
+static char *
+trim(char *s)
+{
+  char *end;
+  s += strspn(s, " \t");
+  end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1]))
+    *--end = 0;
+  return s;
+}
+
+static int
+read_config(struct tools_options *o, char **wc, int *sl)
+{
+  FILE *f = fopen(config_file, "r");
+  char *line = NULL;
+  size_t size = 0;
+  int lineno = 0, rc = 0;
+
+  if (!f)
+  {
+    perror(config_file);
+    return 1;
+  }
+  while (!rc && getline(&line, &size, f) != -1)
+  {
+    const struct option *opt;
+    char *name, *value = strchr(line, '=');
+    lineno++;
+    if (value)
+      *value++ = 0;
+    name = trim(line);
+    if (value)
+      value = trim(value);
+    if (!*name || *name == '#')
+      continue;
+    if (!strncmp(name, "--", 2))
+      name += 2;
+    for (opt = config_opts; opt->name; opt++)
+      if (!strcmp(opt->name, name))
+        break;
+    if (!opt->name || (opt->has_arg == required_argument) != !!value)
+      rc = 1;
+    else if (opt->val == CONFIG_WORD_CHARS)
+    {
+      free(*wc);
+      *wc = strdup(value);
+    }
+    else if (opt->val == CONFIG_SCROLL_LINES)
+    {
+      long n;
+      if (!(rc = parse_number(value, 1, 1000, &n)))
+        *sl = n;
+    }
+    else
+      rc = tools_parse_option(opt->val, value, o);
+    if (rc)
+      fprintf(stderr, "%s:%d: invalid setting %s\n", config_file, lineno,
+              name);
+  }
+  free(line);
+  fclose(f);
   return rc;
 }
 
+/* Read the file again and apply what changed; return 1 if the word
+   characters changed. */
+static int
+reload_config(void)
+{
+  struct tools_options o = base_options;
+  char *wc = NULL;
+  int sl = base_scroll_lines, lut_changed;
+  const char *new_word_chars;
+  uint64_t start = now_usec();
+  size_t i;
+
+  if (read_config(&o, &wc, &sl))
+  {
+    fprintf(stderr, "%s: keeping the current settings\n", config_file);
+    free(wc);
+    return 0;
+  }
+  if (o.all_devices != options.all_devices
+      || strcmp(o.match_name, options.match_name)
+      || strcmp(o.match_property, options.match_property))
+  {
+    fprintf(stderr, "%s: changes to the device selection need a restart\n",
+            config_file);
+    /* keep it consistent for hotplugged devices until then */
+    o.all_devices = options.all_devices;
+    memcpy(o.match_name, options.match_name, sizeof(o.match_name));
+    memcpy(o.match_property, options.match_property,
+           sizeof(o.match_property));
+  }
+  for (i = 0; i < ndevices; i++)
+    tools_device_apply_changes(devices[i], &options, &o);
+  options = o;
+  new_word_chars = wc ? wc : base_word_chars;
+  lut_changed = !word_chars != !new_word_chars
+      || (word_chars && strcmp(word_chars, new_word_chars));
+  word_chars = new_word_chars;
+  free(file_word_chars);
+  file_word_chars = wc;
+  scroll_lines = sl;
+  if (verbose)
+    fprintf(stderr, "%s reloaded in %.3f ms, %zu devices\n", config_file,
+            (now_usec() - start) / 1e3, ndevices);
+  return lut_changed;
+}
+
 static void
-sighandler(int signal, siginfo_t *siginfo, void *userdata)
+config_changed(int fd, uint32_t events, void *data)
 {
-  stop = 1;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const char *name = strrchr(config_file, '/');
+  int changed = 0;
+  ssize_t n;
+
+  name = name ? name + 1 : config_file;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    char *p;
+    for (p = buf; p < buf + n;
+         p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+    {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      if (ev->len && !strcmp(ev->name, name))
+        changed = 1;
+    }
+  }
+  if (changed && reload_config())
+  {
+    set_lut(word_chars);
+    selection_invalidate();
+  }
 }
 
+/* The directory is watched, as editors often replace the file. */
 static void
-mainloop(struct libinput *li)
+watch_config(void)
 {
-  struct pollfd fds;
-  struct sigaction act;
+  const char *slash = strrchr(config_file, '/');
+  char *dir;
 
-  fds.fd = libinput_get_fd(li);
-  fds.events = POLLIN;
-  fds.revents = 0;
+  inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (inotify_fd == -1)
+  {
+    perror("inotify_init1");
+    return;
+  }
+  dir = slash ? strndup(config_file, slash == config_file ? 1 :
+                        slash - config_file) : strdup(".");
+  if (!dir || inotify_add_watch(inotify_fd, dir,
+                                IN_CLOSE_WRITE|IN_MOVED_TO) == -1
+      || !loop_add(inotify_fd, EPOLLIN, config_changed, NULL))
+  {
+    perror(config_file);
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  free(dir);
+}
 
-  memset(&act, 0, sizeof(act));
-  act.sa_sigaction = sighandler;
-  act.sa_flags = SA_SIGINFO;
+static void
+signal_received(int fd, uint32_t events, void *data)
+{
+  struct signalfd_siginfo si;
+  if (read(fd, &si, sizeof(si)) != sizeof(si))
+    return;
+  switch (si.ssi_signo)
+  {
+  case SIGUSR1:
+    metrics_dump();
+    break;
+  case SIGHUP:
+    if (config_file)
+      reload_config();
+    set_lut(word_chars);
+    console_invalidate();
+    selection_invalidate();
+    break;
+  default:
+    loop_stop();
+    break;
+  }
+}
 
-  if (sigaction(SIGINT, &act, NULL) == -1) {
+static void
+mainloop(void)
+{
+  sigset_t mask;
+  int sfd, i;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR1);
+  if ((errno = pthread_sigmask(SIG_BLOCK, &mask, NULL)) ||
+      (sfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1) {
     fprintf(stderr, "Failed to set up signal handling (%s)\n",
         strerror(errno));
     return;
   }
+  if (!loop_add(sfd, EPOLLIN, signal_received, NULL))
+  {
+    close(sfd);
+    return;
+  }
+  for (i = 0; i < nseats; i++)
+    if (!loop_add(libinput_get_fd(seats[i].li), EPOLLIN, libinput_ready,
+                  &seats[i]))
+    {
+      close(sfd);
+      return;
+    }
+  if (console_vt_fd() != -1)
+    watching_vt = loop_add(console_vt_fd(), EPOLLPRI, vt_changed, NULL) != NULL;
+  recheck_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (recheck_fd != -1)
+    loop_add(recheck_fd, EPOLLIN, recheck_mode, NULL);
+  if (config_file)
+    watch_config();
 
   /* Handle already-pending device added events */
-  if (handle_events(li))
-    fprintf(stderr, "Expected device added events on startup but got none. "
-        "Maybe you don't have the right permissions?\n");
+  for (i = 0; i < nseats; i++)
+    if (handle_events(&seats[i]))
+      fprintf(stderr, "Expected device added events on startup but got none "
+          "on %s. Maybe you don't have the right permissions?\n",
+          seats[i].name);
 
-  while (!stop && poll(&fds, 1, -1) > -1)
-    handle_events(li);
+  update_seats();
+  loop_run();
+  if (inotify_fd != -1)
+    close(inotify_fd);
+  if (recheck_fd != -1)
+    close(recheck_fd);
+  close(sfd);
 }
 
 void
@@ -235,6 +1061,9 @@ usage(void)
          "--udev <seat>.... Use udev device discovery (default).\n"
          "                  Specifying a seat ID is optional.\n"
          "--device /path/to/device .... open the given device only\n"
+         "--seat=<seat>[:<vts>] Serve this udev seat, only on the listed VTs\n"
+         "                  (e.g. 1-6,12). May be repeated to serve several\n"
+         "                  seats; overrides --udev.\n"
          "\n"
          "Features:\n"
          "--enable-tap\n"
@@ -261,9 +1090,59 @@ usage(void)
          "These options apply to all applicable devices, if a feature\n"
          "is not explicitly specified it is left at each device's default.\n"
          "\n"
+         "Device selection:\n"
+         "--match-name=<pattern> Only use the devices whose name matches\n"
+         "                  the shell wildcard <pattern>.\n"
+         "--match-udev-property=<name>[=<value>] Only use the devices with\n"
+         "                  this udev property.\n"
+         "--all-devices ... Also open devices without pointer or touch\n"
+         "                  capability, such as keyboards.\n"
+         "\n"
          "Other options:\n"
+         "--config=<file>.. Read device settings, word-chars and scroll-lines\n"
+         "                  from <file>, one per line as in enable-tap or\n"
+         "                  word-chars=a-z, and again whenever it changes.\n"
          "--word-chars=<string>.... List of characters that make up words.\n"
          "                          Ranges (a-z, A-Z, 0-9 etc.) are allowed.\n"
+         "--char-class=<low>[-<high>]:<class>[,...] Set the class of Unicode\n"
+         "                          characters; a word is a run of characters\n"
+         "                          of the same class (as xterm charClass).\n"
+         "--smart-select[=<n>] Select the URL, path, git hash or IP address\n"
+         "                  under the pointer on the n-th click (default 2)\n"
+         "                  instead of a word or line.\n"
+         "--smart-pattern=<regex> Also select matches of this extended\n"
+         "                  regular expression (may be repeated).\n"
+         "--selection-socket=<path> Keep the text of the last selections and\n"
+         "                  serve it on this Unix socket.\n"
+         "--selection-history=<n> Number of selections kept (default: 16).\n"
+         "--control-socket[=<path>] Accept commands from consolationctl on\n"
+         "                  this Unix socket (default: " CSL_CONTROL_SOCKET ").\n"
+         "--mouse-encoding=[kernel|x11|sgr] Let the kernel report mouse\n"
+         "                  buttons (default), or type the reports in the\n"
+         "                  X11 or SGR (1006) encoding, for more than 223\n"
+         "                  columns and for motion reports.\n"
+         "--mouse-motion=[none|drag|any] Also report motion while a button\n"
+         "                  is down, or all motion (needs --mouse-encoding).\n"
+         "--scroll-lines=<n> Lines scrolled per wheel detent (default: 2).\n"
+         "--disable-kinetic-scrolling Stop scrolling as soon as the fingers\n"
+         "                  lift from the touchpad.\n"
+         "--scrollback=<KiB> Keep up to KiB of console history in memory and\n"
+         "                  show it when scrolling (default: 0, use the\n"
+         "                  kernel scrollback if any).\n"
+         "--scrollback-interval=<ms> Time between screen captures\n"
+         "                  (default: 250).\n"
+         "--max-fps=<n>.... Render pointer and selection updates at most\n"
+         "                  n times per second (default: unlimited).\n"
+         "--threads ....... Issue console ioctls from a separate thread.\n"
+         "--realtime[=<prio>] Run with the SCHED_FIFO policy at this priority\n"
+         "                  (default: 10), with all memory locked.\n"
+         "--cpu-affinity=<list> Only run on these CPUs (e.g. 0,2-3).\n"
+         "--fake-console[=<file>] Do not touch the console, but record the\n"
+         "                  operations and write them to <file> on exit.\n"
+         "--fake-latency=<usec> Time spent in each fake console operation.\n"
+         "--record=<file>.. Record the input events to <file>.\n"
+         "--replay=<file>.. Replay recorded input events as fast as possible,\n"
+         "                  print statistics and exit.\n"
          "--grab .......... Exclusively grab all opened devices.\n"
          "--no-daemon...... Do not detach and run in the background.\n"
          "--verbose ....... Print debugging output.\n"
@@ -278,9 +1157,39 @@ version(void)
   printf("%s %s\n", PACKAGE_NAME, PACKAGE_VERSION);
 }
 
+/* Parse a list of CPUs such as 0,2-3 */
+static int
+parse_cpus(const char *list, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  while (*list)
+  {
+    char *end;
+    long first = strtol(list, &end, 10), last = first, cpu;
+    if (end == list)
+      return -1;
+    if (*end == '-')
+    {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list)
+        return -1;
+    }
+    if (first < 0 || last >= CPU_SETSIZE || last < first
+        || (*end && *end != ','))
+      return -1;
+    for (cpu = first; cpu <= last; cpu++)
+      CPU_SET(cpu, set);
+    list = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
 static int
 parse_args(int argc, char **argv)
 {
+  long n;
+
   tools_init_options(&options);
 
   while (1) {
@@ -289,23 +1198,67 @@ parse_args(int argc, char **argv)
     enum {
       OPT_DEVICE = 1,
       OPT_UDEV,
+      OPT_SEAT,
       OPT_GRAB,
       OPT_NO_DAEMON,
       OPT_HELP,
       OPT_VERBOSE,
       OPT_VERSION,
-      OPT_WORD_CHARS
+      OPT_CONFIG,
+      OPT_WORD_CHARS,
+      OPT_CHAR_CLASS,
+      OPT_SMART_SELECT,
+      OPT_SMART_PATTERN,
+      OPT_SELECTION_SOCKET,
+      OPT_SELECTION_HISTORY,
+      OPT_CONTROL_SOCKET,
+      OPT_MAX_FPS,
+      OPT_MOUSE_ENCODING,
+      OPT_MOUSE_MOTION,
+      OPT_SCROLL_LINES,
+      OPT_NO_KINETIC,
+      OPT_THREADS,
+      OPT_REALTIME,
+      OPT_CPU_AFFINITY,
+      OPT_SCROLLBACK,
+      OPT_SCROLLBACK_INTERVAL,
+      OPT_FAKE_CONSOLE,
+      OPT_FAKE_LATENCY,
+      OPT_RECORD,
+      OPT_REPLAY
     };
     static struct option opts[] = {
       CONFIGURATION_OPTIONS,
       { "help",                      no_argument,       0, 'h' },
       { "device",                    required_argument, 0, OPT_DEVICE },
       { "udev",                      required_argument, 0, OPT_UDEV },
+      { "seat",                      required_argument, 0, OPT_SEAT },
       { "grab",                      no_argument,       0, OPT_GRAB },
       { "no-daemon",                 no_argument,       0, OPT_NO_DAEMON },
       { "verbose",                   no_argument,       0, OPT_VERBOSE },
       { "version",                   no_argument,       0, OPT_VERSION },
+      { "config",                    required_argument, 0, OPT_CONFIG },
       { "word-chars",                required_argument, 0, OPT_WORD_CHARS },
+      { "char-class",                required_argument, 0, OPT_CHAR_CLASS },
+      { "smart-select",              optional_argument, 0, OPT_SMART_SELECT },
+      { "smart-pattern",             required_argument, 0, OPT_SMART_PATTERN },
+      { "selection-socket",          required_argument, 0, OPT_SELECTION_SOCKET },
+      { "selection-history",         required_argument, 0, OPT_SELECTION_HISTORY },
+      { "control-socket",            optional_argument, 0, OPT_CONTROL_SOCKET },
+      { "max-fps",                   required_argument, 0, OPT_MAX_FPS },
+      { "mouse-encoding",            required_argument, 0, OPT_MOUSE_ENCODING },
+      { "mouse-motion",              required_argument, 0, OPT_MOUSE_MOTION },
+      { "scroll-lines",              required_argument, 0, OPT_SCROLL_LINES },
+      { "disable-kinetic-scrolling", no_argument,       0, OPT_NO_KINETIC },
+      { "threads",                   no_argument,       0, OPT_THREADS },
+      { "realtime",                  optional_argument, 0, OPT_REALTIME },
+      { "cpu-affinity",              required_argument, 0, OPT_CPU_AFFINITY },
+      { "scrollback",                required_argument, 0, OPT_SCROLLBACK },
+      { "scrollback-interval",       required_argument, 0, OPT_SCROLLBACK_INTERVAL },
+      { "fake-console",              optional_argument, 0, OPT_FAKE_CONSOLE },
+      { "fake-latency",              required_argument, 0, OPT_FAKE_LATENCY },
+      { "record",                    required_argument, 0, OPT_RECORD },
+      { "replay",                    required_argument, 0, OPT_REPLAY },
       { 0, 0, 0, 0}
     };
 
@@ -333,6 +1286,14 @@ parse_args(int argc, char **argv)
       backend = BACKEND_UDEV;
       seat_or_device = optarg;
       break;
+    case OPT_SEAT:
+      backend = BACKEND_UDEV;
+      if (seat_add(optarg))
+      {
+        usage();
+        return 1;
+      }
+      break;
     case OPT_GRAB:
       grab = true;
       break;
@@ -342,9 +1303,159 @@ parse_args(int argc, char **argv)
     case OPT_VERBOSE:
       verbose = true;
       break;
+    case OPT_CONFIG:
+      config_file = optarg;
+      break;
     case OPT_WORD_CHARS:
       word_chars = optarg;
       break;
+    case OPT_CHAR_CLASS:
+      if (words_add_classes(optarg))
+      {
+        fprintf(stderr, "invalid character class: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      break;
+    case OPT_SMART_SELECT:
+      if (!optarg)
+        n = 2;
+      else if (parse_number(optarg, 1, 3, &n))
+      {
+        fprintf(stderr, "invalid click count: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      smart_select = n;
+      break;
+    case OPT_SMART_PATTERN:
+      if (smart_add_pattern(optarg))
+      {
+        usage();
+        return 1;
+      }
+      break;
+    case OPT_SELECTION_SOCKET:
+      selection_socket = optarg;
+      break;
+    case OPT_SELECTION_HISTORY:
+      if (parse_number(optarg, 0, 65536, &n))
+      {
+        fprintf(stderr, "invalid number of selections: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      selection_history = n;
+      break;
+    case OPT_CONTROL_SOCKET:
+      control_socket = optarg ? optarg : CSL_CONTROL_SOCKET;
+      break;
+    case OPT_MAX_FPS:
+      if (parse_number(optarg, 0, 1000000, &n))
+      {
+        fprintf(stderr, "invalid frame rate: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      max_fps = n;
+      break;
+    case OPT_MOUSE_ENCODING:
+      if (!strcmp(optarg, "kernel"))
+        mouse_encoding = MOUSE_ENCODING_KERNEL;
+      else if (!strcmp(optarg, "x11"))
+        mouse_encoding = MOUSE_ENCODING_X11;
+      else if (!strcmp(optarg, "sgr"))
+        mouse_encoding = MOUSE_ENCODING_SGR;
+      else
+      {
+        usage();
+        return 1;
+      }
+      break;
+    case OPT_MOUSE_MOTION:
+      if (!strcmp(optarg, "none"))
+        mouse_motion = MOUSE_MOTION_NONE;
+      else if (!strcmp(optarg, "drag"))
+        mouse_motion = MOUSE_MOTION_DRAG;
+      else if (!strcmp(optarg, "any"))
+        mouse_motion = MOUSE_MOTION_ANY;
+      else
+      {
+        usage();
+        return 1;
+      }
+      break;
+    case OPT_SCROLL_LINES:
+      if (parse_number(optarg, 1, 1000, &n))
+      {
+        fprintf(stderr, "invalid number of lines: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      scroll_lines = n;
+      break;
+    case OPT_NO_KINETIC:
+      kinetic_scrolling = 0;
+      break;
+    case OPT_THREADS:
+      threaded = true;
+      break;
+    case OPT_REALTIME:
+      realtime_priority = optarg ? atoi(optarg) : 10;
+      if (realtime_priority < sched_get_priority_min(SCHED_FIFO)
+          || realtime_priority > sched_get_priority_max(SCHED_FIFO))
+      {
+        fprintf(stderr, "invalid real-time priority: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_CPU_AFFINITY:
+      if (parse_cpus(optarg, &cpu_affinity))
+      {
+        fprintf(stderr, "invalid CPU list: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      cpu_affinity_set = true;
+      break;
+    case OPT_SCROLLBACK:
+      if (parse_number(optarg, 0, LONG_MAX / 1024, &n))
+      {
+        fprintf(stderr, "invalid scrollback size: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      scrollback_kb = n;
+      break;
+    case OPT_SCROLLBACK_INTERVAL:
+      if (parse_number(optarg, 1, 60000, &n))
+      {
+        fprintf(stderr, "invalid scrollback interval: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      scrollback_interval = n;
+      break;
+    case OPT_FAKE_CONSOLE:
+      console = &fake_console;
+      fake_trace = optarg;
+      break;
+    case OPT_FAKE_LATENCY:
+      if (parse_number(optarg, 0, 10000000, &n))
+      {
+        fprintf(stderr, "invalid fake latency: %s\n", optarg);
+        usage();
+        return 1;
+      }
+      fake_latency = n;
+      break;
+    case OPT_RECORD:
+      record_file = optarg;
+      break;
+    case OPT_REPLAY:
+      replay_file = optarg;
+      nodaemon = true;
+      break;
     default:
       if (tools_parse_option(c, optarg, &options) != 0) {
         usage();
@@ -357,6 +1468,12 @@ parse_args(int argc, char **argv)
     usage();
     return 1;
   }
+  if (nseats && backend == BACKEND_DEVICE) {
+    fprintf(stderr, "--seat cannot be used with --device\n");
+    return 1;
+  }
+  if (console == &fake_console)
+    fake_console_init(fake_trace, fake_latency);
   return 0;
 }
 
@@ -365,22 +1482,140 @@ int
 event_init(int argc, char **argv)
 {
   tools_init_options(&options);
-  return parse_args(argc, argv);
+  if (parse_args(argc, argv))
+    return 1;
+  base_options = options;
+  base_word_chars = word_chars;
+  base_scroll_lines = scroll_lines;
+  if (config_file)
+  {
+    if (read_config(&options, &file_word_chars, &scroll_lines))
+      return 1;
+    if (file_word_chars)
+      word_chars = file_word_chars;
+  }
+  return 0;
+}
+
+/* Open the libinput context of every seat; all the udev seats share
+   one udev handle. */
+static int
+open_seats(void)
+{
+  struct udev *udev;
+  int i;
+
+  if (backend == BACKEND_DEVICE)
+  {
+    seats[0].li = tools_open_backend(backend, seat_or_device, verbose, grab);
+    return !seats[0].li;
+  }
+  udev = udev_new();
+  if (!udev)
+  {
+    fprintf(stderr, "Failed to initialize udev\n");
+    return 1;
+  }
+  for (i = 0; i < nseats; i++)
+    if (!(seats[i].li = tools_open_seat(udev, seats[i].name, verbose, grab)))
+      break;
+  udev_unref(udev);
+  return i < nseats;
+}
+
+static void
+close_seats(void)
+{
+  int i;
+  untrack_devices();
+  for (i = 0; i < nseats; i++)
+    if (seats[i].li)
+      libinput_unref(seats[i].li);
+  seat_close();
+}
+
+/* Real-time mode, so that the pointer keeps up on a loaded machine. It
+   is set up before the output thread is started, which inherits it. */
+static int
+set_realtime(void)
+{
+  struct sched_param param = { .sched_priority = realtime_priority };
+  if (cpu_affinity_set && sched_setaffinity(0, sizeof(cpu_affinity),
+                                            &cpu_affinity))
+  {
+    perror("sched_setaffinity");
+    return 1;
+  }
+  if (!realtime_priority)
+    return 0;
+  if (mlockall(MCL_CURRENT|MCL_FUTURE))
+    perror("mlockall");
+  if (sched_setscheduler(0, SCHED_FIFO, &param))
+  {
+    perror("sched_setscheduler");
+    return 1;
+  }
+  return 0;
 }
 
 int
 event_main(void)
 {
-  struct libinput *li;
+  int i;
 
+  if (!nodaemon)
+    metrics_use_syslog();
+  if (set_realtime())
+    return 1;
   set_lut(word_chars);
-  li = tools_open_backend(backend, seat_or_device, verbose, grab);
-  if (!li)
+  if (smart_init())
+    return 1;
+  if (threaded && queue_init())
+    return 1;
+  if (!nseats && seat_add(backend == BACKEND_UDEV ? seat_or_device : "device"))
     return 1;
+  if (loop_init() || schedule_init(max_fps))
+    return 1;
+  for (i = 0; i < nseats; i++)
+    if (kinetic_init(&seats[i]))
+      return 1;
+  if (scrollback_init(scrollback_kb, scrollback_interval)
+      || history_init(selection_socket,
+                      selection_socket || control_socket ? selection_history : 0)
+      || control_init(control_socket))
+    return 1;
+  if (replay_file)
+  {
+    int rc = replay(replay_file);
+    if (verbose)
+      metrics_dump();
+    control_close();
+    history_close();
+    scrollback_close();
+    seat_close();
+    console_close();
+    loop_close();
+    return rc;
+  }
+  if (record_file && record_open(record_file))
+    return 1;
+  if (open_seats())
+  {
+    close_seats();
+    return 1;
+  }
 
-  mainloop(li);
+  mainloop();
 
-  libinput_unref(li);
+  close_seats();
+  if (record_file)
+    record_close();
+  metrics_dump();
+  control_close();
+  history_close();
+  scrollback_close();
+  console_close();
+  loop_close();
 
   return 0;
 }
@@ -0,0 +1,294 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+#include "protocol.h"
+
+/* Local socket servers.
+
+   Clients are non-blocking and served from the main loop. All the
+   complete frames read in one wakeup are handled in a row, and their
+   replies are buffered and written at once; what the socket does not
+   take is written when it becomes writable again.
+*/
+
+struct ipc_client {
+  int fd;
+  struct loop_source *source;
+  struct ipc_server *server;
+  uint8_t *in;
+  size_t in_len;
+  uint8_t *out;
+  size_t out_len, out_cap;
+  size_t last; /* offset of the last reply */
+  struct ipc_client *next;
+};
+
+struct ipc_server {
+  int fd;
+  char *path;
+  struct loop_source *source;
+  ipc_handler handler;
+  struct ipc_client *clients;
+};
+
+static void
+client_close(struct ipc_client *c)
+{
+  struct ipc_client **p;
+  inject_detach(c);
+  for (p = &c->server->clients; *p != c; p = &(*p)->next)
+    ;
+  *p = c->next;
+  loop_remove(c->source);
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+static int
+reserve(struct ipc_client *c, size_t len)
+{
+  if (c->out_len + len > c->out_cap)
+  {
+    size_t cap = c->out_cap ? c->out_cap : 4096;
+    uint8_t *n;
+    while (cap < c->out_len + len)
+      cap *= 2;
+    n = realloc(c->out, cap);
+    if (!n)
+      return -1;
+    c->out = n;
+    c->out_cap = cap;
+  }
+  return 0;
+}
+
+void
+ipc_reply(struct ipc_client *c, const struct csl_msg *req, int status,
+    const void *payload, size_t len)
+{
+  struct csl_msg m;
+  m.length = len;
+  m.type = req->type;
+  m.status = status;
+  if (reserve(c, sizeof(m) + len))
+    return;
+  c->last = c->out_len;
+  memcpy(c->out + c->out_len, &m, sizeof(m));
+  if (len)
+    memcpy(c->out + c->out_len + sizeof(m), payload, len);
+  c->out_len += sizeof(m) + len;
+}
+
+/* Append to the payload of the last reply. */
+
+void
+ipc_reply_append(struct ipc_client *c, const void *data, size_t len)
+{
+  struct csl_msg m;
+  if (!c->out_len || reserve(c, len))
+    return;
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+  memcpy(&m, c->out + c->last, sizeof(m));
+  m.length += len;
+  memcpy(c->out + c->last, &m, sizeof(m));
+}
+
+static int
+flush(struct ipc_client *c)
+{
+  size_t done = 0;
+  while (done < c->out_len)
+  {
+    ssize_t n = write(c->fd, c->out + done, c->out_len - done);
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    done += n;
+  }
+  memmove(c->out, c->out + done, c->out_len - done);
+  c->out_len -= done;
+  loop_modify(c->source, c->out_len ? EPOLLIN|EPOLLOUT : EPOLLIN);
+  return 0;
+}
+
+static void
+client_ready(int fd, uint32_t events, void *data)
+{
+  struct ipc_client *c = data;
+  size_t off = 0;
+  int eof = 0;
+
+  if (events & EPOLLIN)
+    for (;;)
+    {
+      ssize_t n = read(fd, c->in + c->in_len,
+          sizeof(struct csl_msg) + CSL_MAX_PAYLOAD - c->in_len);
+      if (n == 0)
+        eof = 1;
+      if (n <= 0)
+      {
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+          eof = 1;
+        break;
+      }
+      c->in_len += n;
+      /* handle the complete frames, keep the rest */
+      for (;;)
+      {
+        struct csl_msg m;
+        if (c->in_len - off < sizeof(m))
+          break;
+        memcpy(&m, c->in + off, sizeof(m));
+        if (m.length > CSL_MAX_PAYLOAD)
+        {
+          client_close(c);
+          return;
+        }
+        if (c->in_len - off < sizeof(m) + m.length)
+          break;
+        c->server->handler(c, &m, c->in + off + sizeof(m));
+        off += sizeof(m) + m.length;
+      }
+      memmove(c->in, c->in + off, c->in_len - off);
+      c->in_len -= off;
+      off = 0;
+    }
+  if (events & (EPOLLERR|EPOLLHUP))
+    eof = 1;
+  if (flush(c) || (eof && !c->out_len))
+    client_close(c);
+}
+
+static void
+server_ready(int fd, uint32_t events, void *data)
+{
+  struct ipc_server *s = data;
+  int cfd;
+  while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) != -1)
+  {
+    struct ipc_client *c = calloc(1, sizeof(*c));
+    if (c)
+      c->in = malloc(sizeof(struct csl_msg) + CSL_MAX_PAYLOAD);
+    if (!c || !c->in)
+    {
+      if (c)
+        free(c);
+      close(cfd);
+      continue;
+    }
+    c->fd = cfd;
+    c->server = s;
+    c->source = loop_add(cfd, EPOLLIN, client_ready, c);
+    if (!c->source)
+    {
+      free(c->in);
+      free(c);
+      close(cfd);
+      continue;
+    }
+    c->next = s->clients;
+    s->clients = c;
+  }
+}
+
+/* Listen on a Unix socket at path, only accessible to our user. */
+
+struct ipc_server *
+ipc_listen(const char *path, ipc_handler handler)
+{
+  struct sockaddr_un addr;
+  struct ipc_server *s;
+  mode_t mask;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return NULL;
+  }
+  s = calloc(1, sizeof(*s));
+  if (!s)
+    return NULL;
+  s->handler = handler;
+  s->path = strdup(path);
+  s->fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  if (s->fd == -1)
+  {
+    perror("socket");
+    free(s->path);
+    free(s);
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  mask = umask(077);
+  if (bind(s->fd, (struct sockaddr *)&addr, sizeof(addr))
+      || listen(s->fd, 16))
+  {
+    perror(path);
+    umask(mask);
+    close(s->fd);
+    free(s->path);
+    free(s);
+    return NULL;
+  }
+  umask(mask);
+  s->source = loop_add(s->fd, EPOLLIN, server_ready, s);
+  if (!s->source)
+  {
+    ipc_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+void
+ipc_close(struct ipc_server *s)
+{
+  if (!s)
+    return;
+  while (s->clients)
+    client_close(s->clients);
+  loop_remove(s->source);
+  close(s->fd);
+  unlink(s->path);
+  free(s->path);
+  free(s);
+}
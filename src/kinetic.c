@@ -0,0 +1,152 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+
+/* Kinetic scrolling.
+
+   While fingers scroll, the scroll velocity is estimated from the axis
+   events. When they lift with enough speed, scrolling goes on from a
+   timer at FRAME intervals, with the velocity decaying exponentially
+   with time constant TAU, so that each frame issues at most one scroll
+   ioctl. Any touch, button or new scroll stops it.
+
+   Distances are in libinput scroll units; 15 units make one detent.
+*/
+
+#define FRAME     16000   /* usec */
+#define TAU       0.325   /* s */
+#define MIN_SPEED 30.0    /* units/s below which scrolling stops */
+#define MAX_PAUSE 100000  /* usec between the last motion and release */
+
+int kinetic_scrolling = 1;
+
+static void
+set_timer(struct kinetic *k, int on)
+{
+  struct itimerspec its = {{0, 0}, {0, 0}};
+  if (on)
+  {
+    its.it_interval.tv_nsec = FRAME * 1000;
+    its.it_value.tv_nsec = FRAME * 1000;
+  }
+  if (timerfd_settime(k->timer_fd, 0, &its, NULL))
+    perror("timerfd_settime");
+}
+
+void
+kinetic_cancel(struct seat *s)
+{
+  struct kinetic *k = &s->kinetic;
+  k->velocity = 0;
+  k->distance = 0;
+  if (k->coasting)
+    set_timer(k, 0);
+  k->coasting = 0;
+}
+
+void
+kinetic_sample(struct seat *s, uint64_t time, double units)
+{
+  struct kinetic *k = &s->kinetic;
+  if (k->coasting)
+    kinetic_cancel(s);
+  if (k->last_sample && time > k->last_sample)
+  {
+    double v = units * 1e6 / (time - k->last_sample);
+    k->velocity = k->last_sample + MAX_PAUSE > time ?
+      0.6 * v + 0.4 * k->velocity : v;
+  }
+  k->last_sample = time;
+}
+
+void
+kinetic_release(struct seat *s, uint64_t time)
+{
+  struct kinetic *k = &s->kinetic;
+  if (!kinetic_scrolling || k->timer_fd == -1 || !k->last_sample
+      || time > k->last_sample + MAX_PAUSE || fabs(k->velocity) < MIN_SPEED)
+  {
+    kinetic_cancel(s);
+    k->last_sample = 0;
+    return;
+  }
+  k->last_sample = 0;
+  k->last_frame = now_usec();
+  k->coasting = 1;
+  set_timer(k, 1);
+}
+
+static void
+kinetic_frame(int fd, uint32_t events, void *data)
+{
+  struct seat *s = data;
+  struct kinetic *k = &s->kinetic;
+  uint64_t expirations, now;
+  double dt, decay;
+  int v120;
+
+  if (read(fd, &expirations, sizeof(expirations)) < 0 || !k->coasting)
+    return;
+  now = now_usec();
+  dt = (now - k->last_frame) / 1e6;
+  k->last_frame = now;
+  decay = exp(-dt / TAU);
+  /* distance travelled during dt, integrating v(t) = v0 exp(-t/TAU) */
+  k->distance += k->velocity * TAU * (1 - decay);
+  k->velocity *= decay;
+  v120 = (int)(k->distance * 8);
+  if (v120)
+  {
+    k->distance -= v120 / 8.0;
+    vertical_axis(s, v120);
+  }
+  if (fabs(k->velocity) < MIN_SPEED)
+    kinetic_cancel(s);
+}
+
+int
+kinetic_init(struct seat *s)
+{
+  struct kinetic *k = &s->kinetic;
+  if (!kinetic_scrolling)
+    return 0;
+  k->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (k->timer_fd == -1)
+  {
+    perror("timerfd_create");
+    return 1;
+  }
+  if (!loop_add(k->timer_fd, EPOLLIN, kinetic_frame, s))
+    return 1;
+  return 0;
+}
+
+void
+kinetic_close(struct seat *s)
+{
+  if (s->kinetic.timer_fd != -1)
+    close(s->kinetic.timer_fd);
+  s->kinetic.timer_fd = -1;
+}
@@ -0,0 +1,375 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/kd.h>
+#include <linux/vt.h>
+#include <linux/tiocl.h>
+#include <errno.h>
+
+#include "consolation.h"
+
+/* A single handle on /dev/tty0 is kept open for the lifetime of the
+   daemon. /dev/tty0 always refers to the foreground console, so the same
+   fd remains valid across VT switches. */
+
+static int console_fd = -1;
+unsigned long console_reopens = 0;
+
+static int
+console_open(void)
+{
+  int fd = open("/dev/tty0", O_RDWR|O_CLOEXEC);
+  if (fd == -1)
+  {
+    perror("open /dev/tty0");
+    return -1;
+  }
+  if (console_fd == -1)
+    console_fd = fd;
+  else
+  {
+    /* Replace the stale handle in place, so that the fd number never
+       refers to a closed file. */
+    if (dup2(fd, console_fd) == -1)
+    {
+      perror("dup2 /dev/tty0");
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    console_reopens++;
+  }
+  return 0;
+}
+
+static int
+console_stale(int err)
+{
+  return err == EIO || err == ENXIO || err == EBADF || err == ENODEV;
+}
+
+static int
+console_ioctl(unsigned long request, void *arg)
+{
+  int err;
+  if (console_fd == -1 && console_open())
+    return -1;
+  err = ioctl(console_fd, request, arg);
+  if (err < 0 && console_stale(errno))
+  {
+    /* The console was hung up or torn down under us: reopen and retry
+       once. */
+    if (console_open())
+      return -1;
+    err = ioctl(console_fd, request, arg);
+  }
+  return err;
+}
+
+/* VT switches are notified through /sys/class/tty/tty0/active. */
+
+static int vt_fd = -1;
+
+static int
+linux_watch_fd(void)
+{
+  if (vt_fd == -1)
+    vt_fd = open("/sys/class/tty/tty0/active", O_RDONLY|O_CLOEXEC);
+  return vt_fd;
+}
+
+static int
+linux_active_vt(void)
+{
+  if (vt_fd != -1)
+  {
+    char buf[16];
+    ssize_t n = pread(vt_fd, buf, sizeof(buf)-1, 0);
+    if (n <= 3)
+      return 0;
+    buf[n] = 0;
+    return atoi(buf+3); /* "ttyN\n" */
+  }
+  else
+  {
+    struct vt_stat st;
+    if (console_ioctl(VT_GETSTATE, &st))
+      return 0;
+    return st.v_active;
+  }
+}
+
+static int
+linux_text_mode(void)
+{
+  int mode;
+  if (console_ioctl(KDGETMODE, &mode))
+    return -1;
+  return mode==KD_TEXT;
+}
+
+static int
+linux_get_size(unsigned int *width, unsigned int *height)
+{
+  struct winsize s;
+  if (console_ioctl(TIOCGWINSZ, &s))
+    return -1;
+  *width  = s.ws_col;
+  *height = s.ws_row;
+  return 0;
+}
+
+static int
+linux_get_mouse_reporting(unsigned char *mode)
+{
+  *mode = TIOCL_GETMOUSEREPORTING;
+  return console_ioctl(TIOCLINUX, mode);
+}
+
+static int
+linux_set_selection(int xs, int ys, int xe, int ye, int sel_mode)
+{
+  struct {
+    char argp[2]; /*Force struct alignment*/
+    struct tiocl_selection sel;
+  } s;
+  s.argp[0] = 0; /* unused */
+  s.argp[1] = TIOCL_SETSEL;
+  s.sel.xs = xs;
+  s.sel.ys = ys;
+  s.sel.xe = xe;
+  s.sel.ye = ye;
+  s.sel.sel_mode = sel_mode;
+  return console_ioctl(TIOCLINUX, ((char*)&s)+1);
+}
+
+static int
+linux_paste(void)
+{
+  char subcode = TIOCL_PASTESEL;
+  return console_ioctl(TIOCLINUX, &subcode);
+}
+
+static int
+linux_scroll(int sc)
+{
+  struct {
+    char subcode[4];
+    int sc;
+  } scr;
+  scr.subcode[0] = TIOCL_SCROLLCONSOLE;
+  scr.subcode[1] = 0;
+  scr.subcode[2] = 0;
+  scr.subcode[3] = 0;
+  scr.sc = sc;
+  return console_ioctl(TIOCLINUX, &scr);
+}
+
+static int
+linux_load_lut(const uint32_t *lut)
+{
+  int i;
+  struct {
+    char subcode;
+    char padding[3];
+    uint32_t lut[8];
+  } l;
+  l.subcode = TIOCL_SELLOADLUT;
+  l.padding[0] = l.padding[1] = l.padding[2] = 0;
+  for (i = 0; i < 8; i++)
+    l.lut[i] = lut[i];
+  return console_ioctl(TIOCLINUX, &l);
+}
+
+/* /dev/vcsu is the UTF-32 text of the foreground console, without the
+   header of /dev/vcsa. */
+
+static int vcsu_fd = -1;
+
+static int
+linux_read_text(unsigned int offset, uint32_t *text, unsigned int count)
+{
+  ssize_t n;
+  if (vcsu_fd == -1)
+  {
+    vcsu_fd = open("/dev/vcsu", O_RDONLY|O_CLOEXEC);
+    if (vcsu_fd == -1)
+      return -1;
+  }
+  n = pread(vcsu_fd, text, count * sizeof(*text), offset * sizeof(*text));
+  if (n < 0)
+    return -1;
+  return n / sizeof(*text);
+}
+
+/* /dev/vcsaN starts with a header giving the screen size and cursor
+   position, followed by a character and an attribute byte per cell. */
+
+static int vcsa_fd = -1;
+static int vcsa_vt = 0;
+
+static int
+vcsa_open(int vt)
+{
+  char path[32];
+  if (vcsa_fd != -1 && vcsa_vt == vt)
+    return 0;
+  if (vcsa_fd != -1)
+    close(vcsa_fd);
+  snprintf(path, sizeof(path), "/dev/vcsa%d", vt);
+  vcsa_fd = open(path, O_RDWR|O_CLOEXEC);
+  vcsa_vt = vt;
+  if (vcsa_fd == -1)
+  {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+linux_read_screen(int vt, uint16_t *cells, unsigned int width,
+    unsigned int height)
+{
+  unsigned char header[4];
+  struct iovec iov[2] = {
+    { header, sizeof(header) },
+    { cells, width * height * sizeof(*cells) }
+  };
+  ssize_t n;
+  if (vcsa_open(vt))
+    return -1;
+  n = preadv(vcsa_fd, iov, 2, 0);
+  /* the header only holds the size modulo 256 */
+  if (n != (ssize_t)(iov[0].iov_len + iov[1].iov_len)
+      || header[0] != (unsigned char)height
+      || header[1] != (unsigned char)width)
+    return -1;
+  return 0;
+}
+
+static int
+linux_write_screen(int vt, unsigned int offset, const uint16_t *cells,
+    unsigned int count)
+{
+  ssize_t n;
+  if (vcsa_open(vt))
+    return -1;
+  n = pwrite(vcsa_fd, cells, count * sizeof(*cells),
+      4 + offset * sizeof(*cells));
+  return n == (ssize_t)(count * sizeof(*cells)) ? 0 : -1;
+}
+
+/* Typing into /dev/ttyN */
+
+static int tty_fd = -1;
+static int tty_vt = 0;
+
+static int
+tty_open(int vt)
+{
+  char path[32];
+  if (tty_fd != -1 && tty_vt == vt)
+    return 0;
+  if (tty_fd != -1)
+    close(tty_fd);
+  snprintf(path, sizeof(path), "/dev/tty%d", vt);
+  tty_fd = open(path, O_RDWR|O_NOCTTY|O_NONBLOCK|O_CLOEXEC);
+  tty_vt = vt;
+  return tty_fd == -1 ? -1 : 0;
+}
+
+static int
+linux_input_queued(int vt)
+{
+  int n;
+  if (tty_open(vt) || ioctl(tty_fd, FIONREAD, &n))
+    return -1;
+  return n;
+}
+
+static int
+linux_inject(int vt, const char *text, unsigned int len)
+{
+  unsigned int i;
+  if (tty_open(vt))
+    return -1;
+  for (i = 0; i < len; i++)
+    if (ioctl(tty_fd, TIOCSTI, text + i))
+      return i ? (int)i : -1;
+  return len;
+}
+
+static int
+linux_bracketed_paste(void)
+{
+#ifdef TIOCL_GETBRACKETEDPASTE
+  unsigned char mode = TIOCL_GETBRACKETEDPASTE;
+  if (console_ioctl(TIOCLINUX, &mode))
+    return -1;
+  return mode != 0;
+#else
+  return -1;
+#endif
+}
+
+static void
+linux_close(void)
+{
+  if (console_fd != -1)
+    close(console_fd);
+  console_fd = -1;
+  if (vt_fd != -1)
+    close(vt_fd);
+  vt_fd = -1;
+  if (vcsu_fd != -1)
+    close(vcsu_fd);
+  vcsu_fd = -1;
+  if (vcsa_fd != -1)
+    close(vcsa_fd);
+  vcsa_fd = -1;
+  if (tty_fd != -1)
+    close(tty_fd);
+  tty_fd = -1;
+}
+
+const struct console_backend linux_console = {
+  "linux",
+  linux_watch_fd,
+  linux_active_vt,
+  linux_text_mode,
+  linux_get_size,
+  linux_get_mouse_reporting,
+  linux_set_selection,
+  linux_paste,
+  linux_scroll,
+  linux_load_lut,
+  linux_read_text,
+  linux_read_screen,
+  linux_write_screen,
+  linux_input_queued,
+  linux_inject,
+  linux_bracketed_paste,
+  linux_close
+};
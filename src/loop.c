@@ -0,0 +1,160 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+
+/* Main loop.
+
+   Every file descriptor the daemon waits on (libinput, VT switches,
+   timers, signals, sockets) is registered here with a handler, and
+   loop_run() dispatches them with epoll until loop_stop() is called.
+   Sources removed while a batch of events is being dispatched are only
+   freed at the end of the batch, so that pending events for them are
+   safely skipped.
+*/
+
+#define MAX_EVENTS 16
+
+struct loop_source {
+  int fd;
+  loop_handler handler;
+  void *data;
+  struct loop_source *next_dead;
+};
+
+static int epoll_fd = -1;
+static int stopped = 0;
+static struct loop_source *dead = NULL;
+
+int
+loop_init(void)
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    perror("epoll_create1");
+    return 1;
+  }
+  return 0;
+}
+
+struct loop_source *
+loop_add(int fd, uint32_t events, loop_handler handler, void *data)
+{
+  struct epoll_event ev;
+  struct loop_source *s = malloc(sizeof(*s));
+  if (!s)
+    return NULL;
+  s->fd = fd;
+  s->handler = handler;
+  s->data = data;
+  s->next_dead = NULL;
+  ev.events = events;
+  ev.data.ptr = s;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+  {
+    perror("epoll_ctl");
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+int
+loop_modify(struct loop_source *s, uint32_t events)
+{
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = s;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->fd, &ev))
+  {
+    perror("epoll_ctl");
+    return 1;
+  }
+  return 0;
+}
+
+void
+loop_remove(struct loop_source *s)
+{
+  if (!s)
+    return;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+  s->handler = NULL;
+  s->next_dead = dead;
+  dead = s;
+}
+
+static void
+free_dead(void)
+{
+  while (dead)
+  {
+    struct loop_source *s = dead;
+    dead = s->next_dead;
+    free(s);
+  }
+}
+
+void
+loop_stop(void)
+{
+  stopped = 1;
+}
+
+int
+loop_run(void)
+{
+  struct epoll_event ev[MAX_EVENTS];
+  stopped = 0;
+  while (!stopped)
+  {
+    int i, n = epoll_wait(epoll_fd, ev, MAX_EVENTS, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return 1;
+    }
+    metrics_wakeups++;
+    for (i = 0; i < n; i++)
+    {
+      struct loop_source *s = ev[i].data.ptr;
+      if (s->handler)
+        s->handler(s->fd, ev[i].events, s->data);
+    }
+    free_dead();
+  }
+  return 0;
+}
+
+void
+loop_close(void)
+{
+  free_dead();
+  if (epoll_fd != -1)
+    close(epoll_fd);
+  epoll_fd = -1;
+}
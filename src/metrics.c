@@ -0,0 +1,216 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "consolation.h"
+
+/* Counters and latency histograms.
+
+   Latencies are kept in log-linear histograms, in the manner of
+   HdrHistogram: values are bucketed by their highest set bit, and each
+   power of two is split in HIST_SUB linear sub-buckets, so that every
+   bucket is accurate to within 1/HIST_SUB of its value. This covers
+   1ns to 2^42 ns, about 73 minutes, in a few KB without any allocation.
+
+   All of these are only updated by the input thread: with --threads,
+   the operations timed by metrics_op() are the ones it issues, queries
+   and queueing included, and the output thread keeps its own statistics
+   (see queue.c).
+*/
+
+static const char *event_names[METRIC_EVENT_COUNT] = {
+  "sync", "pointer motion", "pointer motion absolute", "pointer button",
+  "pointer axis", "touch down", "touch motion", "touch up", "touch frame",
+  "touch cancel", "device added", "device removed", "other"
+};
+
+static const char *op_names[METRIC_OP_COUNT] = {
+  "TIOCL_SETSEL", "TIOCL_PASTESEL", "TIOCL_SELLOADLUT",
+  "TIOCL_GETMOUSEREPORTING", "TIOCL_SCROLLCONSOLE", "KDGETMODE",
+  "TIOCGWINSZ", "active VT", "TIOCSTI"
+};
+
+unsigned long metrics_events[METRIC_EVENT_COUNT];
+unsigned long metrics_wakeups = 0;
+unsigned long metrics_errors = 0;
+static unsigned long op_count[METRIC_OP_COUNT];
+static struct histogram op_latency[METRIC_OP_COUNT];
+static int use_syslog = 0;
+
+/* End-to-end latency, from the kernel timestamp of the oldest input
+   event not rendered yet to the completion of the console operation that
+   renders it. Events that render nothing are forgotten at the end of
+   their batch. With --threads, the operation completes when it is
+   queued. */
+static uint64_t input_time = 0;  /* usec, CLOCK_MONOTONIC */
+static struct histogram input_latency;
+
+static int
+hist_bucket(uint64_t v)
+{
+  int e;
+  if (v < HIST_SUB)
+    return v;
+  e = 63 - __builtin_clzll(v) - HIST_SUB_BITS; /* >= 0 */
+  if (e + 1 >= HIST_EXP)
+    return HIST_BUCKETS - 1;
+  return (e + 1) * HIST_SUB + ((v >> e) & (HIST_SUB - 1));
+}
+
+static uint64_t
+hist_value(int b)
+{
+  int e = b / HIST_SUB - 1;
+  if (e < 0)
+    return b;
+  /* upper end of the bucket */
+  return ((uint64_t)(HIST_SUB + b % HIST_SUB + 1) << e) - 1;
+}
+
+void
+hist_add(struct histogram *h, uint64_t v)
+{
+  h->count[hist_bucket(v)]++;
+  h->total++;
+  if (v > h->max)
+    h->max = v;
+}
+
+uint64_t
+hist_percentile(const struct histogram *h, double p)
+{
+  unsigned long seen = 0, rank = (unsigned long)(p * h->total);
+  int b;
+  if (!h->total)
+    return 0;
+  for (b = 0; b < HIST_BUCKETS; b++)
+  {
+    seen += h->count[b];
+    if (seen > rank)
+      return hist_value(b) < h->max ? hist_value(b) : h->max;
+  }
+  return h->max;
+}
+
+uint64_t
+metrics_start(void)
+{
+  return now_nsec();
+}
+
+void
+metrics_op(enum metric_op op, uint64_t start, int err)
+{
+  uint64_t now = now_nsec();
+  op_count[op]++;
+  hist_add(&op_latency[op], now - start);
+  if (err < 0)
+    metrics_errors++;
+  if (input_time && (op == METRIC_OP_SETSEL || op == METRIC_OP_PASTESEL
+                     || op == METRIC_OP_SCROLLCONSOLE
+                     || op == METRIC_OP_TIOCSTI))
+  {
+    if (now > input_time * 1000)
+      hist_add(&input_latency, now - input_time * 1000);
+    input_time = 0;
+  }
+}
+
+void
+metrics_input(uint64_t time)
+{
+  if (!input_time)
+    input_time = time;
+}
+
+void
+metrics_input_clear(void)
+{
+  input_time = 0;
+}
+
+void
+metrics_use_syslog(void)
+{
+  openlog("consolation", LOG_PID, LOG_DAEMON);
+  use_syslog = 1;
+}
+
+void
+metrics_write(FILE *f)
+{
+  int i;
+  fprintf(f, "poll wakeups: %lu\n", metrics_wakeups);
+  for (i = 0; i < METRIC_EVENT_COUNT; i++)
+    if (metrics_events[i])
+      fprintf(f, "event %s: %lu\n", event_names[i], metrics_events[i]);
+  for (i = 0; i < METRIC_OP_COUNT; i++)
+  {
+    const struct histogram *h = &op_latency[i];
+    if (!op_count[i])
+      continue;
+    fprintf(f, "%s: %lu calls, latency (us) p50 %.1f p90 %.1f p99 %.1f "
+        "max %.1f\n", op_names[i], op_count[i],
+        hist_percentile(h, 0.5)/1e3, hist_percentile(h, 0.9)/1e3,
+        hist_percentile(h, 0.99)/1e3, h->max/1e3);
+  }
+  if (input_latency.total)
+    fprintf(f, "input to console latency (us): %lu renders, p50 %.1f "
+        "p99 %.1f max %.1f\n", input_latency.total,
+        hist_percentile(&input_latency, 0.5)/1e3,
+        hist_percentile(&input_latency, 0.99)/1e3, input_latency.max/1e3);
+  fprintf(f, "errors: %lu\n", metrics_errors);
+  fprintf(f, "console reopens: %lu\n", console_reopens);
+  fprintf(f, "console state cache: %lu hits, %lu misses\n",
+      console_cache_hits, console_cache_misses);
+  fprintf(f, "selection updates: %lu emitted, %lu suppressed\n",
+      selection_emitted, selection_suppressed);
+  if (threaded)
+    queue_report(f);
+  scrollback_report(f);
+  inject_report(f);
+  if (console == &fake_console)
+    fake_console_report(f);
+}
+
+void
+metrics_dump(void)
+{
+  char *buf = NULL, *line, *save;
+  size_t size;
+  FILE *f;
+
+  if (!use_syslog)
+  {
+    metrics_write(stderr);
+    return;
+  }
+  f = open_memstream(&buf, &size);
+  if (!f)
+    return;
+  metrics_write(f);
+  fclose(f);
+  for (line = strtok_r(buf, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save))
+    syslog(LOG_INFO, "%s", line);
+  free(buf);
+}
@@ -0,0 +1,90 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef CONSOLATION_PROTOCOL_H
+#define CONSOLATION_PROTOCOL_H
+
+#include <stdint.h>
+
+/* Protocol of the consolation sockets.
+
+   Every request and reply is a frame made of a header and length bytes of
+   payload, in host byte order since both ends are on the same machine.
+   Clients may send any number of frames at once; the replies come in the
+   same order, one for each request, with the type of the request and a
+   status of 0 or an errno value.
+*/
+
+#define CSL_MAX_PAYLOAD 65536
+#define CSL_CONTROL_SOCKET "/run/consolation.sock"
+
+struct csl_msg {
+  uint32_t length;  /* of the payload */
+  uint16_t type;
+  uint16_t status;
+};
+
+enum csl_msg_type {
+  /* selection history; index 0 is the newest selection */
+  CSL_MSG_HISTORY_COUNT = 1, /* reply: uint32_t count */
+  CSL_MSG_HISTORY_GET,       /* request: uint32_t index; reply: UTF-8 text */
+  CSL_MSG_HISTORY_LIST,      /* reply: uint32_t length and text for each */
+
+  /* control socket, which also answers the above */
+  CSL_MSG_SET_SELECTION = 16, /* request: struct csl_selection */
+  CSL_MSG_PASTE,
+  CSL_MSG_SCROLL,             /* request: int32_t lines */
+  CSL_MSG_QUERY_POINTER,      /* reply: struct csl_pointer */
+  CSL_MSG_QUERY_SELECTION,    /* reply: struct csl_selection */
+  CSL_MSG_QUERY_SCREEN,       /* reply: struct csl_screen */
+  CSL_MSG_METRICS,            /* reply: text of the statistics */
+  CSL_MSG_PASTE_TEXT,         /* request: uint32_t flags, then the text */
+};
+
+/* flags of CSL_MSG_PASTE_TEXT; by default the text is bracketed if the
+   application asked for it and the kernel can tell */
+
+#define CSL_PASTE_CONTINUE 1 /* the next request continues the text */
+#define CSL_PASTE_BRACKETED 2
+#define CSL_PASTE_RAW 4      /* never bracketed */
+
+enum csl_selection_mode {
+  CSL_SELECT_CHAR,
+  CSL_SELECT_WORD,
+  CSL_SELECT_LINE
+};
+
+/* Coordinates are console cells, counted from 1. */
+
+struct csl_selection {
+  int32_t xs, ys, xe, ye;
+  int32_t mode; /* enum csl_selection_mode */
+};
+
+struct csl_pointer {
+  int32_t x, y;
+  int32_t button; /* 0 left, 1 middle, 2 right, 3 none */
+};
+
+struct csl_screen {
+  uint32_t width, height;
+  uint32_t active_vt;
+  uint32_t text_mode;
+  uint32_t mouse_reporting;
+};
+
+#endif
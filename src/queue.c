@@ -0,0 +1,546 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <linux/tiocl.h>
+
+#include "consolation.h"
+
+/* Console output thread.
+
+   With --threads, console operations are not issued by the input thread:
+   they are pushed to a lock-free single-producer single-consumer ring and
+   applied by an output thread, so that a console ioctl stalled on the
+   console lock does not stop the daemon from draining libinput. Queries
+   (mode, size, mouse reporting, screen contents) and typing stay
+   synchronous; the backend is not thread-safe, so they take backend_lock,
+   which the output thread holds while it applies an operation.
+
+   The input thread never waits for that lock, as a stalled ioctl would
+   stall it too. While an operation is in flight, mode, size, mouse
+   reporting and bracketed paste are answered from the last result, and
+   reading the screen or the input queue fails with EAGAIN, upon which
+   word and smart selection fall back to the kernel, a scrollback capture
+   is skipped and a paste backs off. Short sequences, such as mouse
+   reports, are then typed by the output thread, after the operations
+   before them; longer text is only typed when the ring is empty, so that
+   it stays in order. Only writing the screen, and queue_drain(), wait.
+
+   As operations are applied later, their errors are only counted in
+   queue_errors: the input thread always sees them succeed.
+
+   The output thread drains the ring in batches and skips a selection
+   update when the next one in the batch has the same mode, since only the
+   latest pointer position or selection extent matters. Mouse reports and
+   other operations are always applied, in order.
+*/
+
+#define QUEUE_SIZE 4096 /* power of 2 */
+
+enum queue_op_type {
+  QUEUE_OP_SELECTION,
+  QUEUE_OP_PASTE,
+  QUEUE_OP_SCROLL,
+  QUEUE_OP_LOAD_LUT,
+  QUEUE_OP_INJECT,
+  QUEUE_OP_STOP
+};
+
+#define QUEUE_INJECT_MAX 32
+
+struct queue_op {
+  enum queue_op_type type;
+  int arg[5];
+  union {
+    uint32_t lut[8];
+    char text[QUEUE_INJECT_MAX];
+  };
+  uint64_t time;   /* when queued, in nsec */
+};
+
+static struct queue_op ring[QUEUE_SIZE];
+static _Atomic size_t head = 0; /* written by the input thread */
+static _Atomic size_t tail = 0; /* written by the output thread */
+static atomic_int sleeping = 0;
+static int wake_fd = -1;
+static pthread_t thread;
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+static const struct console_backend *output = NULL;
+
+/* Statistics, which the output thread updates while the main thread may
+   report them: counters are atomic, and queue_latency is only touched
+   under stats_lock. */
+static atomic_ulong queue_stalls = 0;
+static atomic_ulong queue_skipped = 0;
+static atomic_ulong queue_errors = 0;
+static struct histogram queue_latency;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+wake(void)
+{
+  uint64_t one = 1;
+  if (atomic_load(&sleeping))
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+      perror("queue: write");
+}
+
+static void
+push(const struct queue_op *op)
+{
+  size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  if (h - atomic_load_explicit(&tail, memory_order_acquire) == QUEUE_SIZE)
+  {
+    /* Full: the console has been stalled for thousands of operations */
+    struct timespec ts = { 0, 100000 };
+    atomic_fetch_add_explicit(&queue_stalls, 1, memory_order_relaxed);
+    wake();
+    while (h - atomic_load_explicit(&tail, memory_order_acquire) == QUEUE_SIZE)
+      nanosleep(&ts, NULL);
+  }
+  ring[h % QUEUE_SIZE] = *op;
+  ring[h % QUEUE_SIZE].time = now_nsec();
+  atomic_store_explicit(&head, h + 1, memory_order_release);
+  /* Order the store of head before the load of sleeping, as the output
+     thread orders its store of sleeping before its load of head: either
+     it sees the new head, or we see it sleeping. */
+  atomic_thread_fence(memory_order_seq_cst);
+  wake();
+}
+
+static int
+coalescable(const struct queue_op *op, const struct queue_op *next)
+{
+  return op->type == QUEUE_OP_SELECTION && next->type == QUEUE_OP_SELECTION
+      && op->arg[4] == next->arg[4]
+      && op->arg[4] != TIOCL_SELCLEAR
+      && !(op->arg[4] & TIOCL_SELMOUSEREPORT);
+}
+
+static int
+apply(const struct queue_op *op)
+{
+  int err = 0;
+  switch (op->type)
+  {
+  case QUEUE_OP_SELECTION:
+    err = output->set_selection(op->arg[0], op->arg[1], op->arg[2],
+        op->arg[3], op->arg[4]);
+    if (err < 0 && !(op->arg[4] & TIOCL_SELMOUSEREPORT))
+      perror("selection: TIOCLINUX");
+    break;
+  case QUEUE_OP_PASTE:
+    if ((err = output->paste()) < 0)
+      perror("paste: TIOCLINUX");
+    break;
+  case QUEUE_OP_SCROLL:
+    if ((err = output->scroll(op->arg[0])) < 0)
+      perror("scroll: TIOCLINUX");
+    break;
+  case QUEUE_OP_LOAD_LUT:
+    if ((err = output->load_lut(op->lut)) < 0)
+      perror("set_lut: TIOCLINUX");
+    break;
+  case QUEUE_OP_INJECT:
+    if ((err = output->inject(op->arg[0], op->text, op->arg[1])) < op->arg[1])
+    {
+      perror("inject: TIOCSTI");
+      err = -1;
+    }
+    break;
+  case QUEUE_OP_STOP:
+    return 1;
+  }
+  if (err < 0)
+    atomic_fetch_add_explicit(&queue_errors, 1, memory_order_relaxed);
+  pthread_mutex_lock(&stats_lock);
+  hist_add(&queue_latency, now_nsec() - op->time);
+  pthread_mutex_unlock(&stats_lock);
+  return 0;
+}
+
+static void *
+output_thread(void *data)
+{
+  int stop;
+  for (;;)
+  {
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&head, memory_order_acquire);
+    if (t == h)
+    {
+      uint64_t n;
+      atomic_store(&sleeping, 1);
+      if (t == atomic_load(&head))
+        if (read(wake_fd, &n, sizeof(n)) < 0)
+          perror("queue: read");
+      atomic_store(&sleeping, 0);
+      continue;
+    }
+    for (; t != h; t++)
+    {
+      struct queue_op *op = &ring[t % QUEUE_SIZE];
+      if (t + 1 != h && coalescable(op, &ring[(t + 1) % QUEUE_SIZE]))
+      {
+        atomic_fetch_add_explicit(&queue_skipped, 1, memory_order_relaxed);
+        continue;
+      }
+      pthread_mutex_lock(&backend_lock);
+      stop = apply(op);
+      pthread_mutex_unlock(&backend_lock);
+      if (stop)
+      {
+        atomic_store_explicit(&tail, t + 1, memory_order_release);
+        return NULL;
+      }
+    }
+    atomic_store_explicit(&tail, t, memory_order_release);
+  }
+}
+
+/* Take backend_lock unless an operation is in flight. */
+
+static int
+try_lock(void)
+{
+  if (pthread_mutex_trylock(&backend_lock))
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+static int
+queued_watch_fd(void)
+{
+  int r;
+  pthread_mutex_lock(&backend_lock);
+  r = output->watch_fd();
+  pthread_mutex_unlock(&backend_lock);
+  return r;
+}
+
+/* Last answers to the state queries */
+
+static struct {
+  int active_vt, text_mode, size, mouse_reporting_err, bracketed_paste;
+  unsigned int width, height;
+  unsigned char mouse_reporting;
+  int has_active_vt, has_text_mode, has_size, has_mouse_reporting,
+      has_bracketed_paste;
+} last;
+
+/* Take backend_lock to answer a state query, unless an operation is in
+   flight and the last answer is known. */
+
+static int
+lock_unless_known(int known)
+{
+  if (!pthread_mutex_trylock(&backend_lock))
+    return 1;
+  if (known)
+    return 0;
+  pthread_mutex_lock(&backend_lock);
+  return 1;
+}
+
+static int
+queued_active_vt(void)
+{
+  if (lock_unless_known(last.has_active_vt))
+  {
+    last.active_vt = output->active_vt();
+    last.has_active_vt = 1;
+    pthread_mutex_unlock(&backend_lock);
+  }
+  return last.active_vt;
+}
+
+static int
+queued_text_mode(void)
+{
+  if (lock_unless_known(last.has_text_mode))
+  {
+    last.text_mode = output->text_mode();
+    last.has_text_mode = 1;
+    pthread_mutex_unlock(&backend_lock);
+  }
+  return last.text_mode;
+}
+
+static int
+queued_get_size(unsigned int *width, unsigned int *height)
+{
+  if (lock_unless_known(last.has_size))
+  {
+    last.size = output->get_size(&last.width, &last.height);
+    last.has_size = 1;
+    pthread_mutex_unlock(&backend_lock);
+  }
+  if (!last.size)
+  {
+    *width = last.width;
+    *height = last.height;
+  }
+  return last.size;
+}
+
+static int
+queued_get_mouse_reporting(unsigned char *mode)
+{
+  if (lock_unless_known(last.has_mouse_reporting))
+  {
+    last.mouse_reporting_err = output->get_mouse_reporting(
+        &last.mouse_reporting);
+    last.has_mouse_reporting = 1;
+    pthread_mutex_unlock(&backend_lock);
+  }
+  *mode = last.mouse_reporting;
+  return last.mouse_reporting_err;
+}
+
+static int
+queued_set_selection(int xs, int ys, int xe, int ye, int sel_mode)
+{
+  struct queue_op op;
+  op.type = QUEUE_OP_SELECTION;
+  op.arg[0] = xs;
+  op.arg[1] = ys;
+  op.arg[2] = xe;
+  op.arg[3] = ye;
+  op.arg[4] = sel_mode;
+  push(&op);
+  return 0;
+}
+
+static int
+queued_paste(void)
+{
+  struct queue_op op;
+  op.type = QUEUE_OP_PASTE;
+  push(&op);
+  return 0;
+}
+
+static int
+queued_scroll(int sc)
+{
+  struct queue_op op;
+  op.type = QUEUE_OP_SCROLL;
+  op.arg[0] = sc;
+  push(&op);
+  return 0;
+}
+
+static int
+queued_load_lut(const uint32_t *lut)
+{
+  struct queue_op op;
+  op.type = QUEUE_OP_LOAD_LUT;
+  memcpy(op.lut, lut, sizeof(op.lut));
+  push(&op);
+  return 0;
+}
+
+static int
+queued_read_text(unsigned int offset, uint32_t *text, unsigned int count)
+{
+  int r;
+  if (try_lock())
+    return -1;
+  r = output->read_text(offset, text, count);
+  pthread_mutex_unlock(&backend_lock);
+  return r;
+}
+
+static int
+queued_read_screen(int vt, uint16_t *cells, unsigned int width,
+    unsigned int height)
+{
+  int r;
+  if (try_lock())
+    return -1;
+  r = output->read_screen(vt, cells, width, height);
+  pthread_mutex_unlock(&backend_lock);
+  return r;
+}
+
+static int
+queued_write_screen(int vt, unsigned int offset, const uint16_t *cells,
+    unsigned int count)
+{
+  int r;
+  pthread_mutex_lock(&backend_lock);
+  r = output->write_screen(vt, offset, cells, count);
+  pthread_mutex_unlock(&backend_lock);
+  return r;
+}
+
+static int
+queued_input_queued(int vt)
+{
+  int r;
+  if (try_lock())
+    return -1;
+  r = output->input_queued(vt);
+  pthread_mutex_unlock(&backend_lock);
+  return r;
+}
+
+static int
+queue_empty(void)
+{
+  return atomic_load_explicit(&tail, memory_order_acquire)
+      == atomic_load_explicit(&head, memory_order_relaxed);
+}
+
+static int
+queued_inject(int vt, const char *text, unsigned int len)
+{
+  struct queue_op op;
+  int r;
+  if (queue_empty() && !try_lock())
+  {
+    r = output->inject(vt, text, len);
+    pthread_mutex_unlock(&backend_lock);
+    return r;
+  }
+  if (len > QUEUE_INJECT_MAX)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  op.type = QUEUE_OP_INJECT;
+  op.arg[0] = vt;
+  op.arg[1] = len;
+  memcpy(op.text, text, len);
+  push(&op);
+  return len;
+}
+
+static int
+queued_bracketed_paste(void)
+{
+  if (lock_unless_known(last.has_bracketed_paste))
+  {
+    last.bracketed_paste = output->bracketed_paste();
+    last.has_bracketed_paste = 1;
+    pthread_mutex_unlock(&backend_lock);
+  }
+  return last.bracketed_paste;
+}
+
+static void
+queued_close(void)
+{
+  struct queue_op op;
+  op.type = QUEUE_OP_STOP;
+  push(&op);
+  pthread_join(thread, NULL);
+  close(wake_fd);
+  console = output;
+  output->close();
+}
+
+static const struct console_backend queued_console = {
+  "queued",
+  queued_watch_fd,
+  queued_active_vt,
+  queued_text_mode,
+  queued_get_size,
+  queued_get_mouse_reporting,
+  queued_set_selection,
+  queued_paste,
+  queued_scroll,
+  queued_load_lut,
+  queued_read_text,
+  queued_read_screen,
+  queued_write_screen,
+  queued_input_queued,
+  queued_inject,
+  queued_bracketed_paste,
+  queued_close
+};
+
+/* The output thread is created with all signals blocked, so that the
+   signals handled by the main loop through its signalfd are never
+   delivered to it. */
+
+int
+queue_init(void)
+{
+  sigset_t all, old;
+  int err;
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd == -1)
+  {
+    perror("eventfd");
+    return 1;
+  }
+  output = console;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&thread, NULL, output_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err)
+  {
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    close(wake_fd);
+    return 1;
+  }
+  console = &queued_console;
+  return 0;
+}
+
+/* Wait until the output thread has applied every queued operation, for
+   the rare reads of the screen that must not fail. */
+
+void
+queue_drain(void)
+{
+  struct timespec ts = { 0, 100000 };
+  if (console != &queued_console)
+    return;
+  while (!queue_empty())
+    nanosleep(&ts, NULL);
+}
+
+void
+queue_report(FILE *f)
+{
+  struct histogram latency;
+  pthread_mutex_lock(&stats_lock);
+  latency = queue_latency;
+  pthread_mutex_unlock(&stats_lock);
+  fprintf(f, "output thread: %lu skipped, %lu stalls, %lu errors, "
+      "latency (us) p50 %.1f p99 %.1f max %.1f\n",
+      atomic_load_explicit(&queue_skipped, memory_order_relaxed),
+      atomic_load_explicit(&queue_stalls, memory_order_relaxed),
+      atomic_load_explicit(&queue_errors, memory_order_relaxed),
+      hist_percentile(&latency, 0.5)/1e3,
+      hist_percentile(&latency, 0.99)/1e3, latency.max/1e3);
+}
@@ -0,0 +1,195 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "consolation.h"
+
+/* Recording and replay of input events.
+
+   A record file starts with a struct record_header, followed by
+   struct csl_event records in host byte order. A CSL_EVENT_SYNC record
+   marks the end of each batch of events read from libinput, so that
+   the replay coalesces motion exactly like the live daemon did.
+*/
+
+#define RECORD_MAGIC   0x524c5343 /* "CSLR" */
+#define RECORD_VERSION 1
+
+struct record_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+};
+
+static FILE *record_fp = NULL;
+
+int
+record_open(const char *path)
+{
+  struct record_header h = { RECORD_MAGIC, RECORD_VERSION,
+                             sizeof(struct csl_event) };
+  record_fp = fopen(path, "w");
+  if (!record_fp)
+  {
+    perror(path);
+    return 1;
+  }
+  if (fwrite(&h, sizeof(h), 1, record_fp) != 1)
+  {
+    perror(path);
+    fclose(record_fp);
+    record_fp = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+void
+record_event(const struct csl_event *e)
+{
+  if (record_fp && fwrite(e, sizeof(*e), 1, record_fp) != 1)
+  {
+    perror("record");
+    fclose(record_fp);
+    record_fp = NULL;
+  }
+}
+
+void
+record_sync(void)
+{
+  struct csl_event e;
+  memset(&e, 0, sizeof(e));
+  e.type = CSL_EVENT_SYNC;
+  e.time = now_usec();
+  record_event(&e);
+}
+
+void
+record_close(void)
+{
+  if (record_fp)
+    fclose(record_fp);
+  record_fp = NULL;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64_t
+percentile(const uint64_t *v, size_t n, double p)
+{
+  size_t i = (size_t)(p * (n - 1) + 0.5);
+  return v[i];
+}
+
+/* Feed a recording to the first seat as fast as possible, and print the
+   time spent on each record. A SYNC record counts as one and its time is
+   that of rendering the batch, console operations included. */
+
+int
+replay(const char *path)
+{
+  struct record_header h;
+  struct csl_event e;
+  uint64_t *lat = NULL;
+  size_t n = 0, alloc = 0;
+  unsigned long ops, suppressed;
+  uint64_t start, total;
+  int rc = 0;
+  FILE *f = fopen(path, "r");
+
+  if (!f)
+  {
+    perror(path);
+    return 1;
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != RECORD_MAGIC
+      || h.version != RECORD_VERSION || h.size != sizeof(e))
+  {
+    fprintf(stderr, "%s: not a recording of this version\n", path);
+    fclose(f);
+    return 1;
+  }
+  ops = selection_emitted + console_operations;
+  suppressed = selection_suppressed;
+  console_update_state();
+  start = now_nsec();
+  while (fread(&e, sizeof(e), 1, f) == 1)
+  {
+    uint64_t t0 = now_nsec();
+    if (e.type > CSL_EVENT_TOUCH_CANCEL)
+    {
+      fprintf(stderr, "%s: invalid event type %d\n", path, e.type);
+      rc = 1;
+      break;
+    }
+    if (e.type == CSL_EVENT_SYNC)
+    {
+      /* the end of a batch, where motion is rendered */
+      input_flush(&seats[0]);
+      console_update_state();
+    }
+    else
+      input_dispatch(&seats[0], &e);
+    if (n == alloc)
+    {
+      uint64_t *l;
+      alloc = alloc ? 2*alloc : 4096;
+      l = realloc(lat, alloc * sizeof(*lat));
+      if (!l)
+      {
+        perror("replay");
+        break;
+      }
+      lat = l;
+    }
+    lat[n++] = now_nsec() - t0;
+  }
+  input_flush(&seats[0]);
+  schedule_flush();
+  total = now_nsec() - start;
+  fclose(f);
+
+  ops = selection_emitted + console_operations - ops;
+  suppressed = selection_suppressed - suppressed;
+  printf("events: %zu in %.3f ms, %.0f events/s\n", n, total/1e6,
+         total ? n * 1e9 / total : 0.);
+  printf("console operations: %lu emitted, %lu suppressed\n",
+         ops, suppressed);
+  if (n)
+  {
+    qsort(lat, n, sizeof(*lat), cmp_u64);
+    printf("latency (ns): p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, "
+           "max %llu\n",
+           (unsigned long long)percentile(lat, n, 0.5),
+           (unsigned long long)percentile(lat, n, 0.9),
+           (unsigned long long)percentile(lat, n, 0.99),
+           (unsigned long long)percentile(lat, n, 0.999),
+           (unsigned long long)lat[n-1]);
+  }
+  free(lat);
+  return rc;
+}
@@ -0,0 +1,107 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+
+/* Output pacing.
+
+   Pointer and selection updates caused by motion are rendered at most
+   max_fps times per second. An update that comes too early is only
+   recorded, and the latest pointer state is rendered when the timer
+   expires. Buttons are never delayed: the input code calls
+   schedule_flush() before handling them. The rate is shared by all the
+   seats, each of which only renders its latest state.
+*/
+
+static int timer_fd = -1;
+static uint64_t interval = 0;
+static uint64_t last_render = 0;
+static int armed = 0;
+
+static void
+schedule_timer(int fd, uint32_t events, void *data)
+{
+  uint64_t expirations;
+  if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+    return;
+  armed = 0;
+  schedule_flush();
+}
+
+int
+schedule_init(int max_fps)
+{
+  if (max_fps <= 0)
+    return 0;
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (timer_fd == -1)
+  {
+    perror("timerfd_create");
+    return 1;
+  }
+  interval = 1000000 / max_fps;
+  if (!loop_add(timer_fd, EPOLLIN, schedule_timer, NULL))
+    return 1;
+  return 0;
+}
+
+static void
+render(struct seat *s, uint64_t now)
+{
+  s->render_pending = 0;
+  last_render = now;
+  render_pointer(s);
+}
+
+static void
+arm(uint64_t when)
+{
+  struct itimerspec its = {{0, 0}, {when/1000000, (when%1000000)*1000}};
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+    perror("timerfd_settime");
+  else
+    armed = 1;
+}
+
+void
+schedule_render(struct seat *s)
+{
+  uint64_t now = now_usec();
+  if (!interval || now >= last_render + interval)
+    render(s, now);
+  else
+  {
+    s->render_pending = 1;
+    if (!armed)
+      arm(last_render + interval);
+  }
+}
+
+void
+schedule_flush(void)
+{
+  int i;
+  for (i = 0; i < nseats; i++)
+    if (seats[i].render_pending)
+      render(&seats[i], now_usec());
+}
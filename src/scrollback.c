@@ -0,0 +1,487 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+
+#include "consolation.h"
+
+/* Userspace scrollback.
+
+   Recent kernels no longer keep a scrollback buffer behind
+   TIOCL_SCROLLCONSOLE. With --scrollback, the screen of the foreground
+   console is read from /dev/vcsaN every capture interval, and each row is
+   hashed. Comparing the row hashes with those of the previous snapshot
+   tells how many lines scrolled off the top, and only those rows are
+   stored. Lines that scroll by faster than a screen per interval are lost.
+
+   Stored lines are deduplicated through a hash table and their attributes
+   are run-length encoded, with trailing blanks dropped. Each VT has its
+   own ring of lines, and the oldest lines of the longest history are
+   dropped when the memory budget is exceeded.
+
+   Scrolling back writes the history view to /dev/vcsaN, so that the
+   kernel selection works on it, after saving the live screen. The screen
+   is restored when scrolling back to the bottom, or as soon as a row of
+   the view changes, e.g. because a program wrote to the console. Rows
+   changed that way are left alone.
+*/
+
+#define MAX_VT  64
+#define BUCKETS 4096
+
+struct line {
+  struct line *next; /* hash chain */
+  uint64_t hash;
+  uint32_t refs;
+  uint16_t len;      /* cells before the trailing blanks */
+  uint16_t nruns;
+  uint8_t fill;      /* attribute of the trailing blanks */
+  /* followed by uint16_t lens[nruns], uint8_t attrs[nruns],
+     uint8_t chars[len] */
+};
+
+struct history {
+  struct line **ring;
+  size_t cap, first, count;
+};
+
+static size_t budget = 0;
+static size_t used = 0;
+static unsigned long unique = 0;
+static struct line *buckets[BUCKETS];
+static struct history *vts[MAX_VT];
+static int timer_fd = -1;
+
+static unsigned int width = 0, height = 0;
+static uint16_t *cur = NULL, *prev = NULL, *saved = NULL, *view = NULL;
+static uint64_t *cur_hash = NULL, *prev_hash = NULL, *view_hash = NULL;
+static uint8_t *scratch = NULL;
+static int prev_vt = 0;  /* VT of prev, 0 if none */
+static int view_vt = 0;  /* VT showing the history */
+static size_t offset = 0; /* lines back in history, 0 for the live screen */
+
+static size_t
+line_size(unsigned int len, unsigned int nruns)
+{
+  return sizeof(struct line) + nruns*3 + len;
+}
+
+static uint64_t
+fnv(uint64_t h, const void *data, size_t n)
+{
+  const uint8_t *p = data;
+  while (n--)
+    h = (h ^ *p++) * 0x100000001b3ULL;
+  return h;
+}
+
+static void
+hash_rows(const uint16_t *screen, uint64_t *hashes)
+{
+  unsigned int r;
+  for (r = 0; r < height; r++)
+    hashes[r] = fnv(0xcbf29ce484222325ULL, screen + r*width,
+        width*sizeof(*screen));
+}
+
+/* Encode a row into scratch and return the interned line. */
+
+static struct line *
+intern(const uint16_t *row)
+{
+  uint16_t *lens = (uint16_t *)scratch;
+  uint8_t *attrs, *chars;
+  unsigned int len = width, nruns = 0, i;
+  uint8_t fill = row[width-1] >> 8;
+  struct line *l, **b;
+  size_t payload;
+  uint64_t hash;
+
+  while (len > 0 && row[len-1] == (' ' | fill << 8))
+    len--;
+  for (i = 0; i < len; i++)
+    if (!i || row[i] >> 8 != row[i-1] >> 8)
+      nruns++;
+  attrs = scratch + nruns*2;
+  chars = attrs + nruns;
+  nruns = 0;
+  for (i = 0; i < len; i++)
+  {
+    if (!i || row[i] >> 8 != row[i-1] >> 8)
+    {
+      attrs[nruns] = row[i] >> 8;
+      lens[nruns++] = 0;
+    }
+    lens[nruns-1]++;
+    chars[i] = row[i] & 0xff;
+  }
+  payload = line_size(len, nruns) - sizeof(struct line);
+  hash = fnv(0xcbf29ce484222325ULL ^ fill, scratch, payload);
+
+  b = &buckets[hash % BUCKETS];
+  for (l = *b; l; l = l->next)
+    if (l->hash == hash && l->len == len && l->nruns == nruns
+        && l->fill == fill && !memcmp(l + 1, scratch, payload))
+    {
+      l->refs++;
+      return l;
+    }
+  l = malloc(line_size(len, nruns));
+  if (!l)
+    return NULL;
+  l->hash = hash;
+  l->refs = 1;
+  l->len = len;
+  l->nruns = nruns;
+  l->fill = fill;
+  memcpy(l + 1, scratch, payload);
+  l->next = *b;
+  *b = l;
+  used += line_size(len, nruns);
+  unique++;
+  return l;
+}
+
+static void
+unref(struct line *l)
+{
+  struct line **p;
+  if (--l->refs)
+    return;
+  for (p = &buckets[l->hash % BUCKETS]; *p != l; p = &(*p)->next)
+    ;
+  *p = l->next;
+  used -= line_size(l->len, l->nruns);
+  unique--;
+  free(l);
+}
+
+static void
+decode(const struct line *l, uint16_t *row)
+{
+  const uint16_t *lens = (const uint16_t *)(l + 1);
+  const uint8_t *attrs = (const uint8_t *)(lens + l->nruns);
+  const uint8_t *chars = attrs + l->nruns;
+  unsigned int i = 0, r, n;
+  for (r = 0; r < l->nruns && i < width; r++)
+    for (n = 0; n < lens[r] && i < width; n++, i++)
+      row[i] = chars[i] | attrs[r] << 8;
+  for (; i < width; i++)
+    row[i] = ' ' | l->fill << 8;
+}
+
+static struct line *
+history_line(const struct history *h, size_t i)
+{
+  return h->ring[(h->first + i) % h->cap];
+}
+
+/* The rings count in the budget: they grow by doubling, shrink by half
+   when a quarter full, and are freed when empty. */
+static int
+set_capacity(struct history *h, size_t cap)
+{
+  struct line **ring = NULL;
+  size_t i;
+  if (cap && !(ring = malloc(cap * sizeof(*ring))))
+    return -1;
+  for (i = 0; i < h->count; i++)
+    ring[i] = history_line(h, i);
+  free(h->ring);
+  used += cap * sizeof(*ring);
+  used -= h->cap * sizeof(*ring);
+  h->ring = ring;
+  h->cap = cap;
+  h->first = 0;
+  return 0;
+}
+
+/* Drop the oldest line of the longest history; return 0 if all the
+   histories are empty. */
+static int
+evict(void)
+{
+  struct history *h = NULL;
+  int vt;
+  for (vt = 0; vt < MAX_VT; vt++)
+    if (vts[vt] && vts[vt]->count && (!h || vts[vt]->count > h->count))
+      h = vts[vt];
+  if (!h)
+    return 0;
+  unref(history_line(h, 0));
+  h->first = (h->first + 1) % h->cap;
+  h->count--;
+  if (!h->count)
+    set_capacity(h, 0);
+  else if (h->cap > 256 && h->count <= h->cap / 4)
+    set_capacity(h, h->cap / 2);
+  if (h == vts[view_vt] && offset > h->count)
+    offset = h->count;
+  return 1;
+}
+
+static void
+history_push(int vt, const uint16_t *row)
+{
+  struct history *h;
+  struct line *l;
+  if (vt <= 0 || vt >= MAX_VT)
+    return;
+  if (!vts[vt] && !(vts[vt] = calloc(1, sizeof(struct history))))
+    return;
+  h = vts[vt];
+  if (h->count == h->cap && set_capacity(h, h->cap ? h->cap*2 : 256))
+    return;
+  l = intern(row);
+  if (!l)
+    return;
+  h->ring[(h->first + h->count++) % h->cap] = l;
+  while (used > budget && evict())
+    ;
+}
+
+static int
+resize(void)
+{
+  size_t cells = (size_t)screen_width * screen_height;
+  width = screen_width;
+  height = screen_height;
+  prev_vt = 0;
+  view_vt = 0;
+  offset = 0;
+  free(cur); free(prev); free(saved); free(view);
+  free(cur_hash); free(prev_hash); free(view_hash);
+  free(scratch);
+  cur = malloc(cells * sizeof(*cur));
+  prev = malloc(cells * sizeof(*prev));
+  saved = malloc(cells * sizeof(*saved));
+  view = malloc(cells * sizeof(*view));
+  cur_hash = malloc(height * sizeof(*cur_hash));
+  prev_hash = malloc(height * sizeof(*prev_hash));
+  view_hash = malloc(height * sizeof(*view_hash));
+  scratch = malloc(width * 4);
+  if (!cur || !prev || !saved || !view || !cur_hash || !prev_hash
+      || !view_hash || !scratch)
+  {
+    width = height = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/* Number of lines that scrolled off the top between prev and cur. The
+   last row of prev is not compared, as it may have been completed since. */
+
+static unsigned int
+shift(void)
+{
+  unsigned int k;
+  for (k = 0; k + 1 < height; k++)
+    if (!memcmp(prev_hash + k, cur_hash, (height-1-k) * sizeof(*cur_hash)))
+      return k;
+  return 0;
+}
+
+static void
+end_view(void)
+{
+  unsigned int r;
+  int changed = 0;
+  uint16_t *t;
+  if (!offset)
+    return;
+  offset = 0;
+  prev_vt = 0;
+  queue_drain();
+  if (console->read_screen(view_vt, cur, width, height))
+    return;
+  hash_rows(cur, cur_hash);
+  for (r = 0; r < height; r++)
+    changed |= cur_hash[r] != view_hash[r];
+  if (!changed)
+    console->write_screen(view_vt, 0, saved, width*height);
+  else
+    for (r = 0; r < height; r++)
+      if (cur_hash[r] == view_hash[r])
+        console->write_screen(view_vt, r*width, saved + r*width, width);
+      else
+        memcpy(saved + r*width, cur + r*width, width*sizeof(*saved));
+  /* saved is now the screen, and the base of the next capture */
+  t = prev; prev = saved; saved = t;
+  hash_rows(prev, prev_hash);
+  prev_vt = view_vt;
+}
+
+static void
+render_view(void)
+{
+  struct history *h = vts[view_vt];
+  unsigned int r;
+  for (r = 0; r < height; r++)
+  {
+    size_t i = h->count - offset + r;
+    if (i < h->count)
+      decode(history_line(h, i), view + r*width);
+    else
+      memcpy(view + r*width, saved + (i - h->count)*width,
+          width*sizeof(*view));
+  }
+  hash_rows(view, view_hash);
+  if (console->write_screen(view_vt, 0, view, width*height))
+    perror("scrollback: write");
+}
+
+static int
+capture(void)
+{
+  int vt;
+  uint16_t *t;
+  uint64_t *th;
+  unsigned int k, n;
+  if (!console_text_mode())
+    return -1;
+  console_update_state();
+  vt = console_active_vt;
+  if (width != screen_width || height != screen_height)
+    if (resize())
+      return -1;
+  if (!width || !height || console->read_screen(vt, cur, width, height))
+  {
+    prev_vt = 0;
+    return -1;
+  }
+  hash_rows(cur, cur_hash);
+  if (offset)
+  {
+    if (vt == view_vt && memcmp(cur_hash, view_hash,
+          height*sizeof(*cur_hash)))
+      end_view();
+    return -1;
+  }
+  if (vt == prev_vt)
+    for (k = 0, n = shift(); k < n; k++)
+      history_push(vt, prev + k*width);
+  t = prev; prev = cur; cur = t;
+  th = prev_hash; prev_hash = cur_hash; cur_hash = th;
+  prev_vt = vt;
+  return 0;
+}
+
+static void
+capture_timer(int fd, uint32_t events, void *data)
+{
+  uint64_t expirations;
+  if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+    return;
+  capture();
+}
+
+int
+scrollback_init(long kb, long interval_ms)
+{
+  struct itimerspec its;
+  if (kb <= 0)
+    return 0;
+  budget = kb * 1024;
+  if (interval_ms <= 0)
+    interval_ms = 250;
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (timer_fd == -1)
+  {
+    perror("timerfd_create");
+    return 1;
+  }
+  its.it_interval.tv_sec = interval_ms / 1000;
+  its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(timer_fd, 0, &its, NULL))
+  {
+    perror("timerfd_settime");
+    return 1;
+  }
+  if (!loop_add(timer_fd, EPOLLIN, capture_timer, NULL))
+    return 1;
+  return 0;
+}
+
+/* Scroll the history view of the foreground console; positive values
+   go towards the live screen, as TIOCL_SCROLLCONSOLE. Return -1 if the
+   scrollback is disabled. */
+
+int
+scrollback_scroll(int lines)
+{
+  struct history *h;
+  size_t o;
+  if (!budget)
+    return -1;
+  if (offset && view_vt != console_active_vt)
+    end_view();
+  if (!offset)
+  {
+    if (lines >= 0 || capture())
+      return 0;
+    memcpy(saved, prev, width*height*sizeof(*saved));
+    view_vt = prev_vt;
+  }
+  h = vts[view_vt];
+  if (!h || !h->count)
+    return 0;
+  if (lines < 0)
+    o = offset - lines > h->count ? h->count : offset - lines;
+  else
+    o = offset > (size_t)lines ? offset - lines : 0;
+  if (o == offset)
+    return 0;
+  if (!o)
+  {
+    end_view();
+    return 0;
+  }
+  offset = o;
+  render_view();
+  return 0;
+}
+
+void
+scrollback_report(FILE *f)
+{
+  size_t lines = 0;
+  int vt;
+  if (!budget)
+    return;
+  for (vt = 0; vt < MAX_VT; vt++)
+    if (vts[vt])
+      lines += vts[vt]->count;
+  fprintf(f, "scrollback: %zu lines, %lu unique, %zu of %zu KiB\n",
+      lines, unique, used/1024, budget/1024);
+}
+
+void
+scrollback_close(void)
+{
+  end_view();
+  if (timer_fd != -1)
+    close(timer_fd);
+  timer_fd = -1;
+}
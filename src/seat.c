@@ -0,0 +1,118 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "consolation.h"
+
+/* Seats.
+
+   A single daemon serves every seat given with --seat=NAME[:VTLIST], each
+   with its own libinput context and pointer, sharing one udev handle. A
+   seat only acts when the foreground VT is in its list of VTs, and is
+   suspended otherwise; without a list, it acts on every VT. Without
+   --seat, the daemon serves seat0, or the device given with --device.
+*/
+
+struct seat seats[MAX_SEATS];
+int nseats = 0;
+
+static int
+parse_vts(const char *list, uint64_t *vts)
+{
+  *vts = 0;
+  while (*list)
+  {
+    char *end;
+    long first = strtol(list, &end, 10), last = first, vt;
+    if (end == list)
+      return -1;
+    if (*end == '-')
+    {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list)
+        return -1;
+    }
+    if (first < 1 || last >= 64 || last < first || (*end && *end != ','))
+      return -1;
+    for (vt = first; vt <= last; vt++)
+      *vts |= 1ULL << vt;
+    list = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+int
+seat_add(const char *spec)
+{
+  struct seat *s;
+  const char *colon = strchr(spec, ':');
+  if (nseats == MAX_SEATS)
+  {
+    fprintf(stderr, "too many seats\n");
+    return -1;
+  }
+  s = &seats[nseats];
+  memset(s, 0, sizeof(*s));
+  s->name = colon ? strndup(spec, colon - spec) : strdup(spec);
+  if (!s->name || (colon && parse_vts(colon + 1, &s->vts)))
+  {
+    fprintf(stderr, "invalid seat: %s\n", spec);
+    free((char *)s->name);
+    return -1;
+  }
+  s->kinetic.timer_fd = -1;
+  action_init(s);
+  nseats++;
+  return 0;
+}
+
+int
+seat_active(const struct seat *s)
+{
+  int vt = console_active_vt;
+  return !s->vts || (vt > 0 && vt < 64 && s->vts & (1ULL << vt));
+}
+
+/* The seat of the foreground VT, for requests that do not come from a
+   seat. */
+
+struct seat *
+seat_current(void)
+{
+  int i;
+  for (i = 0; i < nseats; i++)
+    if (seat_active(&seats[i]))
+      return &seats[i];
+  return &seats[0];
+}
+
+void
+seat_close(void)
+{
+  int i;
+  for (i = 0; i < nseats; i++)
+  {
+    kinetic_close(&seats[i]);
+    free((char *)seats[i].name);
+  }
+  nseats = 0;
+}
@@ -16,78 +16,106 @@
 */
 
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
 #include <linux/tiocl.h>
 #include <stdint.h>
-#include <linux/kd.h>
 #include <errno.h>
 
 #include "consolation.h"
 
 static int
-check_mode(int fd)
+check_mode(void)
 {
-  int mode;
-  ioctl(fd, KDGETMODE, &mode);
-  return mode==KD_TEXT;
+  return console_text_mode();
 }
 
 void
 set_screen_size_and_mouse_reporting(void)
 {
-  struct winsize s;
-  int fd = open("/dev/tty0",O_RDONLY);
-  if (fd == -1)
-  {
-    perror("open /dev/tty0");
-    return;
-  }
-  if (ioctl(fd, TIOCGWINSZ, &s))
-  {
+  unsigned char request;
+  uint64_t t = metrics_start();
+  int err = console->get_size(&screen_width, &screen_height);
+  metrics_op(METRIC_OP_TIOCGWINSZ, t, err);
+  if (err)
     perror("TIOCGWINSZ");
-  }
-  else
-  {
-    screen_width  = s.ws_col;
-    screen_height = s.ws_row;
-  }
-  unsigned char request = TIOCL_GETMOUSEREPORTING;
-  if (ioctl(fd, TIOCLINUX, &request))
+  t = metrics_start();
+  err = console->get_mouse_reporting(&request);
+  metrics_op(METRIC_OP_GETMOUSEREPORTING, t, err);
+  if (err)
   {
     perror("TIOCLINUX, TIOCL_GETMOUSEREPORTING");
     request = MOUSE_REPORTING_OFF;
   }
-  close(fd);
   if (request >= MOUSE_REPORTING_MODE_COUNT)
   {
     fprintf(stderr, "mouse reporting mode %d not supported\n", (int)request);
     request = MOUSE_REPORTING_OFF;
   }
   mouse_reporting = request;
-  close(fd);
+}
+
+/* Last selection state sent to the kernel. The console only has integer
+   cells, so motion within a cell would otherwise issue the very same
+   TIOCL_SETSEL again. Mouse reports are events for the application and
+   are never suppressed. With --threads, the operations are applied later
+   and always seem to succeed, so a failed one is not retried. */
+
+static struct {
+  int valid;
+  int xs, ys, xe, ye;
+  int sel_mode;
+} rendered;
+unsigned long console_operations = 0; /* other than selections */
+unsigned long selection_emitted = 0;
+unsigned long selection_suppressed = 0;
+
+void
+selection_invalidate(void)
+{
+  rendered.valid = 0;
+}
+
+/* The current selection, or -1 if there is none. */
+
+int
+selection_get(int *xs, int *ys, int *xe, int *ye, int *sel_mode)
+{
+  if (!rendered.valid || rendered.sel_mode == TIOCL_SELPOINTER
+      || rendered.sel_mode == TIOCL_SELCLEAR)
+    return -1;
+  *xs = rendered.xs; *ys = rendered.ys;
+  *xe = rendered.xe; *ye = rendered.ye;
+  *sel_mode = rendered.sel_mode;
+  return 0;
+}
+
+static int
+selection_unchanged(int xs, int ys, int xe, int ye, int sel_mode)
+{
+  if (sel_mode & TIOCL_SELMOUSEREPORT)
+    return 0;
+  if (!rendered.valid || rendered.sel_mode != sel_mode)
+    return 0;
+  if (sel_mode == TIOCL_SELCLEAR)
+    return 1;
+  return rendered.xs == xs && rendered.ys == ys
+      && rendered.xe == xe && rendered.ye == ye;
 }
 
 static void
-linux_selection(int xs, int ys, int xe, int ye, int sel_mode)
-{
-  int fd;
-  struct {
-    char argp[2]; /*Force struct alignment*/
-    struct tiocl_selection sel;
-  } s;
-  s.argp[0] = 0; /* unused */
-  s.argp[1] = TIOCL_SETSEL;
-  s.sel.xs = xs;
-  s.sel.ys = ys;
-  s.sel.xe = xe<0 ? xs: xe;
-  s.sel.ye = ye<0 ? ys: ye;
-  s.sel.sel_mode = sel_mode;
-  fd = open("/dev/tty0",O_RDONLY);
-  if (check_mode(fd))
+set_selection(int xs, int ys, int xe, int ye, int sel_mode)
+{
+  if (xe < 0) xe = xs;
+  if (ye < 0) ye = ys;
+  if (selection_unchanged(xs, ys, xe, ye, sel_mode))
+  {
+    selection_suppressed++;
+    return;
+  }
+  if (check_mode())
   {
-    int err = ioctl(fd, TIOCLINUX, ((char*)&s)+1);
+    uint64_t t = metrics_start();
+    int err = console->set_selection(xs, ys, xe, ye, sel_mode);
+    metrics_op(METRIC_OP_SETSEL, t, err);
     if (err<0 && !(errno==EINVAL && (sel_mode&TIOCL_SELMOUSEREPORT)))
     /* The kernel return EINVAL for TIOCL_SELMOUSEREPORT when
        TIOCL_GETMOUSEREPORTING reports 0. Unfortunately this cannot be
@@ -95,68 +123,142 @@ linux_selection(int xs, int ys, int xe, int ye, int sel_mode)
        error.
      */
       perror("selection: TIOCLINUX");
+    selection_emitted++;
+    if (!(sel_mode & TIOCL_SELMOUSEREPORT))
+    {
+      rendered.valid = err == 0;
+      rendered.xs = xs; rendered.ys = ys;
+      rendered.xe = xe; rendered.ye = ye;
+      rendered.sel_mode = sel_mode;
+    }
+  }
+}
+
+/* Mouse reports typed as escape sequences, in the X11 encoding, limited
+   to 223 columns and rows, or in the SGR (1006) one, which has no limit
+   and tells which button was released. The kernel has no way to tell
+   which encoding the application asked for. Reports are made at the
+   cell and with the button of the seat, see action.c. */
+
+static void
+type_report(struct seat *s, int motion)
+{
+  enum current_button button = s->button;
+  int x = s->report_x, y = s->report_y;
+  int release = button == BUTTON_RELEASED && !motion;
+  int b = button + (motion ? 32 : 0);
+  char seq[32];
+  int n, err;
+
+  if (!check_mode())
+    return;
+  if (button != BUTTON_RELEASED && !motion)
+    s->report_pressed = button;
+  if (mouse_encoding == MOUSE_ENCODING_SGR)
+    n = snprintf(seq, sizeof(seq), "\033[<%d;%d;%d%c",
+        release ? (int)s->report_pressed : b, x, y, release ? 'm' : 'M');
+  else
+    n = snprintf(seq, sizeof(seq), "\033[M%c%c%c", 32 + b,
+        32 + (x < 223 ? x : 223), 32 + (y < 223 ? y : 223));
+  err = inject_sequence(seq, n);
+  if (err && err != EBUSY)
+  {
+    errno = err;
+    perror("mouse report: TIOCSTI");
   }
-  close(fd);
 }
 
 void
-report_pointer(int x, int y, enum current_button button)
+report_pointer(struct seat *s)
 {
-  linux_selection(x, y, x, y, TIOCL_SELCLEAR);
-  linux_selection(x, y, x, y, TIOCL_SELMOUSEREPORT + button );
+  int x = s->report_x, y = s->report_y;
+  set_selection(x, y, x, y, TIOCL_SELCLEAR);
+  if (mouse_encoding == MOUSE_ENCODING_KERNEL)
+    set_selection(x, y, x, y, TIOCL_SELMOUSEREPORT + s->button);
+  else
+    type_report(s, 0);
+}
+
+void
+report_motion(struct seat *s)
+{
+  type_report(s, 1);
 }
 
 void
 draw_pointer(int x, int y)
 {
-  linux_selection(x, y, x, y, TIOCL_SELPOINTER);
+  set_selection(x, y, x, y, TIOCL_SELPOINTER);
 }
 
 void
 select_region(int x, int y, int x2, int y2)
 {
-  linux_selection(x, y, x2, y2, TIOCL_SELCHAR);
+  set_selection(x, y, x2, y2, TIOCL_SELCHAR);
 }
 
+/* Word selection is computed from the screen contents, so that word
+   boundaries follow our character classes and not the kernel LUT. Only
+   the rows of both ends are read. The kernel selects words by itself if
+   the screen cannot be read. */
+
 void
 select_words(int x, int y, int x2, int y2)
 {
-  linux_selection(x, y, x2, y2, TIOCL_SELWORD);
+  uint32_t text[screen_width ? screen_width : 1];
+  if (y2 < y || (y2 == y && x2 < x))
+  {
+    int t;
+    t = x; x = x2; x2 = t;
+    t = y; y = y2; y2 = t;
+  }
+  if (!screen_width || console_read_row(y, text))
+  {
+    set_selection(x, y, x2, y2, TIOCL_SELWORD);
+    return;
+  }
+  x = word_boundary(text, screen_width, x-1, -1) + 1;
+  if (y2 != y && console_read_row(y2, text))
+  {
+    set_selection(x, y, x2, y2, TIOCL_SELWORD);
+    return;
+  }
+  x2 = word_boundary(text, screen_width, x2-1, 1) + 1;
+  set_selection(x, y, x2, y2, TIOCL_SELCHAR);
 }
 
 void
 select_lines(int x, int y, int x2, int y2)
 {
-  linux_selection(x, y, x2, y2, TIOCL_SELLINE);
+  set_selection(x, y, x2, y2, TIOCL_SELLINE);
 }
 
 void paste(void)
 {
-  char subcode = TIOCL_PASTESEL;
-  int fd = open("/dev/tty0",O_RDWR);
-  if (check_mode(fd))
-    if (ioctl(fd, TIOCLINUX, &subcode)<0)
+  selection_invalidate();
+  console_operations++;
+  if (check_mode())
+  {
+    uint64_t t = metrics_start();
+    int err = console->paste();
+    metrics_op(METRIC_OP_PASTESEL, t, err);
+    if (err<0)
       perror("paste: TIOCLINUX");
-  close(fd);
+  }
 }
 
 void scroll(int sc)
 {
-  int fd;
-  struct {
-    char subcode[4];
-    int sc;
-  } scr;
-  scr.subcode[0] = TIOCL_SCROLLCONSOLE;
-  scr.subcode[1] = 0;
-  scr.subcode[2] = 0;
-  scr.subcode[3] = 0;
-  scr.sc = sc;
-  fd = open("/dev/tty0",O_RDONLY);
-  if (check_mode(fd))
-    if (ioctl(fd, TIOCLINUX, &scr)<0)
+  selection_invalidate();
+  console_operations++;
+  if (check_mode() && scrollback_scroll(sc))
+  {
+    uint64_t t = metrics_start();
+    int err = console->scroll(sc);
+    metrics_op(METRIC_OP_SCROLLCONSOLE, t, err);
+    if (err<0)
       perror("scroll: TIOCLINUX");
-  close(fd);
+  }
 }
 
 static int goodchar(unsigned char x)
@@ -166,12 +268,7 @@ static int goodchar(unsigned char x)
 
 void set_lut(const char *def)
 {
-  int fd;
-  struct {
-    char subcode;
-    char padding[3];
-    uint32_t lut[8];
-  } l = { TIOCL_SELLOADLUT, 0, 0, 0,
+  uint32_t lut[8] = {
     0x00000000, /* control chars     */
     0x03FFE000, /* digits and "-./"  */
     0x87FFFFFE, /* uppercase and '_' */
@@ -186,7 +283,7 @@ void set_lut(const char *def)
   /* we allow changing only U+0020..U+7E */
   if (def)
   {
-    l.lut[1] = l.lut[2] = l.lut[3] = 0;
+    lut[1] = lut[2] = lut[3] = 0;
     while (*def) {
       char c = *def++;
       if (!goodchar(c))
@@ -194,16 +291,20 @@ void set_lut(const char *def)
       if (*def == '-' && goodchar(def[1])) {
         ++def;
         for (; c <= *def; ++c)
-          l.lut[c >> 5] |= 1 << (uint32_t)(c & 31);
+          lut[c >> 5] |= 1 << (uint32_t)(c & 31);
         ++def;
       }
       else
-        l.lut[c >> 5] |= 1 << (uint32_t)(c & 31);
+        lut[c >> 5] |= 1 << (uint32_t)(c & 31);
     }
   }
-  fd = open("/dev/tty0",O_RDWR);
-  if (check_mode(fd))
-    if (ioctl(fd, TIOCLINUX, &l)<0)
+  words_set_lut(lut);
+  if (check_mode())
+  {
+    uint64_t t = metrics_start();
+    int err = console->load_lut(lut);
+    metrics_op(METRIC_OP_SELLOADLUT, t, err);
+    if (err<0)
       perror("set_lut: TIOCLINUX");
-  close(fd);
+  }
 }
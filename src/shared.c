@@ -219,6 +219,27 @@ tools_parse_option(int option,
 				 "%s",
 				 optarg);
 			break;
+		case OPT_ALL_DEVICES:
+			options->all_devices = true;
+			break;
+		case OPT_MATCH_NAME:
+			if (!optarg)
+				return 1;
+
+			snprintf(options->match_name,
+				 sizeof(options->match_name),
+				 "%s",
+				 optarg);
+			break;
+		case OPT_MATCH_UDEV_PROPERTY:
+			if (!optarg)
+				return 1;
+
+			snprintf(options->match_property,
+				 sizeof(options->match_property),
+				 "%s",
+				 optarg);
+			break;
 	}
 
 	return 0;
@@ -251,21 +272,18 @@ static const struct libinput_interface interface = {
 	.close_restricted = close_restricted,
 };
 
-static struct libinput *
-tools_open_udev(const char *seat, bool verbose, bool grab)
+/* The contexts keep a pointer to the grab flag for as long as they live */
+static bool grab_flags[2] = { false, true };
+
+struct libinput *
+tools_open_seat(struct udev *udev, const char *seat, bool verbose, bool grab)
 {
 	struct libinput *li;
-	struct udev *udev = udev_new();
 
-	if (!udev) {
-		fprintf(stderr, "Failed to initialize udev\n");
-		return NULL;
-	}
-
-	li = libinput_udev_create_context(&interface, &grab, udev);
+	li = libinput_udev_create_context(&interface, &grab_flags[grab], udev);
 	if (!li) {
 		fprintf(stderr, "Failed to initialize context from udev\n");
-		goto out;
+		return NULL;
 	}
 
 	if (verbose) {
@@ -274,13 +292,26 @@ tools_open_udev(const char *seat, bool verbose, bool grab)
 	}
 
 	if (libinput_udev_assign_seat(li, seat)) {
-		fprintf(stderr, "Failed to set seat\n");
+		fprintf(stderr, "Failed to set seat %s\n", seat);
 		libinput_unref(li);
 		li = NULL;
-		goto out;
 	}
 
-out:
+	return li;
+}
+
+static struct libinput *
+tools_open_udev(const char *seat, bool verbose, bool grab)
+{
+	struct libinput *li;
+	struct udev *udev = udev_new();
+
+	if (!udev) {
+		fprintf(stderr, "Failed to initialize udev\n");
+		return NULL;
+	}
+
+	li = tools_open_seat(udev, seat, verbose, grab);
 	udev_unref(udev);
 	return li;
 }
@@ -291,7 +322,7 @@ tools_open_device(const char *path, bool verbose, bool grab)
 	struct libinput_device *device;
 	struct libinput *li;
 
-	li = libinput_path_create_context(&interface, &grab);
+	li = libinput_path_create_context(&interface, &grab_flags[grab]);
 	if (!li) {
 		fprintf(stderr, "Failed to initialize context from %s\n", path);
 		return NULL;
@@ -389,6 +420,131 @@ tools_device_apply_config(struct libinput_device *device,
 	}
 }
 
+static bool
+match_udev_property(struct libinput_device *device, const char *match)
+{
+	struct udev_device *udev_device;
+	const char *eq = strchr(match, '=');
+	char name[64];
+	const char *value;
+	bool matched = false;
+
+	snprintf(name, sizeof(name), "%.*s",
+		 eq ? (int)(eq - match) : (int)strlen(match), match);
+	udev_device = libinput_device_get_udev_device(device);
+	if (!udev_device)
+		return false;
+	value = udev_device_get_property_value(udev_device, name);
+	if (value)
+		matched = !eq || streq(value, eq + 1);
+	udev_device_unref(udev_device);
+
+	return matched;
+}
+
+/* Apply the settings that differ between old and new, and put the
+ * settings that new leaves unset back to the device default. */
+void
+tools_device_apply_changes(struct libinput_device *device,
+			   const struct tools_options *old,
+			   const struct tools_options *new)
+{
+	if (new->tapping != old->tapping)
+		libinput_device_config_tap_set_enabled(device,
+			new->tapping != -1 ? new->tapping :
+			libinput_device_config_tap_get_default_enabled(device));
+	if (new->tap_map != old->tap_map)
+		libinput_device_config_tap_set_button_map(device,
+			new->tap_map != (enum libinput_config_tap_button_map)-1 ?
+			new->tap_map :
+			libinput_device_config_tap_get_default_button_map(device));
+	if (new->drag != old->drag)
+		libinput_device_config_tap_set_drag_enabled(device,
+			new->drag != -1 ? new->drag :
+			libinput_device_config_tap_get_default_drag_enabled(device));
+	if (new->drag_lock != old->drag_lock)
+		libinput_device_config_tap_set_drag_lock_enabled(device,
+			new->drag_lock != -1 ? new->drag_lock :
+			libinput_device_config_tap_get_default_drag_lock_enabled(device));
+	if (new->natural_scroll != old->natural_scroll)
+		libinput_device_config_scroll_set_natural_scroll_enabled(device,
+			new->natural_scroll != -1 ? new->natural_scroll :
+			libinput_device_config_scroll_get_default_natural_scroll_enabled(device));
+	if (new->left_handed != old->left_handed)
+		libinput_device_config_left_handed_set(device,
+			new->left_handed != -1 ? new->left_handed :
+			libinput_device_config_left_handed_get_default(device));
+	if (new->middlebutton != old->middlebutton)
+		libinput_device_config_middle_emulation_set_enabled(device,
+			new->middlebutton != -1 ? new->middlebutton :
+			libinput_device_config_middle_emulation_get_default_enabled(device));
+	if (new->dwt != old->dwt)
+		libinput_device_config_dwt_set_enabled(device,
+			new->dwt != -1 ? new->dwt :
+			libinput_device_config_dwt_get_default_enabled(device));
+	if (new->click_method != old->click_method)
+		libinput_device_config_click_set_method(device,
+			new->click_method != (enum libinput_config_click_method)-1 ?
+			new->click_method :
+			libinput_device_config_click_get_default_method(device));
+	if (new->scroll_method != old->scroll_method)
+		libinput_device_config_scroll_set_method(device,
+			new->scroll_method != (enum libinput_config_scroll_method)-1 ?
+			new->scroll_method :
+			libinput_device_config_scroll_get_default_method(device));
+	if (new->scroll_button != old->scroll_button)
+		libinput_device_config_scroll_set_button(device,
+			new->scroll_button != -1 ? (uint32_t)new->scroll_button :
+			libinput_device_config_scroll_get_default_button(device));
+
+	if (libinput_device_config_accel_is_available(device)) {
+		if (new->speed != old->speed)
+			libinput_device_config_accel_set_speed(device,
+							       new->speed);
+		if (new->profile != old->profile)
+			libinput_device_config_accel_set_profile(device,
+				new->profile != LIBINPUT_CONFIG_ACCEL_PROFILE_NONE ?
+				new->profile :
+				libinput_device_config_accel_get_default_profile(device));
+	}
+
+	if (strcmp(new->disable_pattern, old->disable_pattern) &&
+	    libinput_device_config_send_events_get_modes(device) &
+	      LIBINPUT_CONFIG_SEND_EVENTS_DISABLED) {
+		bool disabled = fnmatch(new->disable_pattern,
+					libinput_device_get_name(device),
+					0) != FNM_NOMATCH;
+		libinput_device_config_send_events_set_mode(device,
+			disabled ? LIBINPUT_CONFIG_SEND_EVENTS_DISABLED :
+				   LIBINPUT_CONFIG_SEND_EVENTS_ENABLED);
+	}
+}
+
+/* Whether a device can produce events consolation uses: pointers and
+ * touchscreens, restricted to the ones matching --match-name and
+ * --match-udev-property if given. */
+bool
+tools_device_wanted(struct libinput_device *device,
+		    struct tools_options *options)
+{
+	if (!options->all_devices &&
+	    !libinput_device_has_capability(device,
+					    LIBINPUT_DEVICE_CAP_POINTER) &&
+	    !libinput_device_has_capability(device,
+					    LIBINPUT_DEVICE_CAP_TOUCH))
+		return false;
+	if (options->match_name[0] &&
+	    fnmatch(options->match_name,
+		    libinput_device_get_name(device),
+		    0) == FNM_NOMATCH)
+		return false;
+	if (options->match_property[0] &&
+	    !match_udev_property(device, options->match_property))
+		return false;
+
+	return true;
+}
+
 static char*
 find_device(const char *udev_tag)
 {
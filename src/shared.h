@@ -31,6 +31,8 @@
 
 #include <libinput.h>
 
+struct udev;
+
 enum configuration_options {
 	OPT_TAP_ENABLE = 256,
 	OPT_TAP_DISABLE,
@@ -53,6 +55,9 @@ enum configuration_options {
 	OPT_SPEED,
 	OPT_PROFILE,
 	OPT_DISABLE_SENDEVENTS,
+	OPT_ALL_DEVICES,
+	OPT_MATCH_NAME,
+	OPT_MATCH_UDEV_PROPERTY,
 };
 
 #define CONFIGURATION_OPTIONS \
@@ -76,7 +81,10 @@ enum configuration_options {
 	{ "set-scroll-button",         required_argument, 0, OPT_SCROLL_BUTTON }, \
 	{ "set-profile",               required_argument, 0, OPT_PROFILE }, \
 	{ "set-tap-map",               required_argument, 0, OPT_TAP_MAP }, \
-	{ "set-speed",                 required_argument, 0, OPT_SPEED }
+	{ "set-speed",                 required_argument, 0, OPT_SPEED }, \
+	{ "all-devices",               no_argument,       0, OPT_ALL_DEVICES }, \
+	{ "match-name",                required_argument, 0, OPT_MATCH_NAME }, \
+	{ "match-udev-property",       required_argument, 0, OPT_MATCH_UDEV_PROPERTY }
 
 enum tools_backend {
 	BACKEND_DEVICE,
@@ -98,6 +106,9 @@ struct tools_options {
 	int dwt;
 	enum libinput_config_accel_profile profile;
 	char disable_pattern[64];
+	bool all_devices;
+	char match_name[64];
+	char match_property[64];
 };
 
 void tools_init_options(struct tools_options *options);
@@ -108,8 +119,17 @@ struct libinput* tools_open_backend(enum tools_backend which,
 				    const char *seat_or_device,
 				    bool verbose,
 				    bool grab);
+struct libinput* tools_open_seat(struct udev *udev,
+				 const char *seat,
+				 bool verbose,
+				 bool grab);
 void tools_device_apply_config(struct libinput_device *device,
 			       struct tools_options *options);
+void tools_device_apply_changes(struct libinput_device *device,
+				const struct tools_options *old,
+				const struct tools_options *new);
+bool tools_device_wanted(struct libinput_device *device,
+			 struct tools_options *options);
 int tools_exec_command(const char *prefix, int argc, char **argv);
 
 bool find_touchpad_device(char *path, size_t path_len);
@@ -0,0 +1,170 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <regex.h>
+
+#include "consolation.h"
+
+/* Smart selection.
+
+   On the click selected by --smart-select, the URL, path, git hash or IP
+   address under the pointer is selected instead of a word. All the
+   patterns are POSIX extended regular expressions, combined into a
+   single alternation that is compiled once at startup. On a click,
+   regexec() is called once per match on the clicked row, from its start
+   until a match reaches the clicked column, each call resuming after the
+   previous match. Characters outside ASCII are replaced by a placeholder
+   to keep one byte per cell.
+*/
+
+int smart_select = 0; /* click count, 0 if disabled */
+
+static const char *default_patterns[] = {
+  /* URLs */
+  "[[:alpha:]][[:alnum:]+.-]*://[^[:space:]<>\"'`]+",
+  /* paths, with optional :line[:column] */
+  "(~|\\.{1,2})?/[[:alnum:]_.@+~-]+(/[[:alnum:]_.@+~-]*)*(:[0-9]+){0,2}",
+  "[[:alnum:]_.-]+(/[[:alnum:]_.@+~-]+)*\\.[[:alnum:]]+:[0-9]+(:[0-9]+)?",
+  /* git hashes */
+  "\\<[0-9a-f]{7,40}\\>",
+  /* IPv4 with optional port or prefix length, IPv6 */
+  "\\<[0-9]{1,3}(\\.[0-9]{1,3}){3}(:[0-9]+|/[0-9]{1,2})?\\>",
+  "\\<[0-9a-fA-F]{1,4}(:[0-9a-fA-F]{0,4}){2,7}\\>",
+};
+
+static char **patterns = NULL;
+static size_t npatterns = 0;
+static regex_t matcher;
+static int compiled = 0;
+
+static int
+check_pattern(const char *re)
+{
+  regex_t r;
+  int err = regcomp(&r, re, REG_EXTENDED|REG_NOSUB);
+  if (err)
+  {
+    char msg[128];
+    regerror(err, &r, msg, sizeof(msg));
+    fprintf(stderr, "%s: %s\n", re, msg);
+    return -1;
+  }
+  regfree(&r);
+  return 0;
+}
+
+int
+smart_add_pattern(const char *re)
+{
+  char **n;
+  if (check_pattern(re))
+    return -1;
+  n = realloc(patterns, (npatterns + 1) * sizeof(*patterns));
+  if (!n)
+    return -1;
+  patterns = n;
+  patterns[npatterns++] = (char *)re;
+  return 0;
+}
+
+static void
+append(char **buf, size_t *len, const char *re)
+{
+  size_t l = strlen(re);
+  char *n = realloc(*buf, *len + l + 4);
+  if (!n)
+    return;
+  *buf = n;
+  if (*len)
+    n[(*len)++] = '|';
+  n[(*len)++] = '(';
+  memcpy(n + *len, re, l);
+  *len += l;
+  n[(*len)++] = ')';
+  n[*len] = 0;
+}
+
+int
+smart_init(void)
+{
+  char *re = NULL;
+  size_t len = 0, i;
+  int err;
+  if (!smart_select)
+    return 0;
+  for (i = 0; i < npatterns; i++)
+    append(&re, &len, patterns[i]);
+  for (i = 0; i < sizeof(default_patterns)/sizeof(*default_patterns); i++)
+    append(&re, &len, default_patterns[i]);
+  if (!re)
+    return -1;
+  err = regcomp(&matcher, re, REG_EXTENDED);
+  free(re);
+  if (err)
+  {
+    char msg[128];
+    regerror(err, &matcher, msg, sizeof(msg));
+    fprintf(stderr, "smart selection: %s\n", msg);
+    return -1;
+  }
+  compiled = 1;
+  return 0;
+}
+
+/* Find the match that includes column x of row y (both from 1) and
+   return its first and last column in *xs and *xe. */
+
+int
+smart_match(int x, int y, int *xs, int *xe)
+{
+  uint32_t text[screen_width ? screen_width : 1];
+  char line[screen_width + 1];
+  regmatch_t m;
+  unsigned int i;
+  int off = 0, flags = 0;
+  if (!compiled || !screen_width || console_read_row(y, text))
+    return -1;
+  for (i = 0; i < screen_width; i++)
+    line[i] = text[i] > 0 && text[i] < 0x80 ? (char)text[i] : '\x1a';
+  line[screen_width] = 0;
+  x--;
+  while (off <= x && regexec(&matcher, line + off, 1, &m, flags) == 0)
+  {
+    int s = off + m.rm_so, e = off + m.rm_eo;
+    if (e == s)
+      e++;
+    else
+      /* trailing punctuation rarely belongs to the match */
+      while (e - 1 > s && strchr(".,;:!?)'\"", line[e-1]))
+        e--;
+    if (s > x)
+      break;
+    if (x < e)
+    {
+      *xs = s + 1;
+      *xe = e;
+      return 0;
+    }
+    off = e;
+    flags = REG_NOTBOL;
+  }
+  return -1;
+}
@@ -0,0 +1,183 @@
+/* Copyright © 2016 Bill Allombert
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  Check the License for details. You should have received a copy of it, along
+  with the package; see the file 'COPYING'. If not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "consolation.h"
+
+/* Word boundaries.
+
+   The kernel only lets us choose word characters in U+0020..U+007E and
+   considers everything above U+00FF part of a word, so that double-click
+   selection swallows box drawing, CJK punctuation and the likes. Instead,
+   every character is given a class, as in xterm: a word is a run of
+   characters of the same class. By default letters and digits are class
+   48, blanks class 32, box drawing and block elements class 0x2500, and
+   other punctuation is a class of its own. The classes of U+0000..U+00FF
+   follow the kernel selection LUT (see --word-chars), and --char-class
+   overrides any range.
+*/
+
+#define CLASS_SPACE 32
+#define CLASS_WORD  48
+#define CLASS_FRAME 0x2500
+
+struct class_range {
+  uint32_t low, high;
+  int cls;
+};
+
+static struct class_range *ranges = NULL;
+static size_t nranges = 0;
+static uint32_t word_lut[8] = {
+  0x00000000, 0x03FFE000, 0x87FFFFFE, 0x07FFFFFE,
+  0x00000000, 0x00000000, 0xFF7FFFFF, 0xFF7FFFFF
+};
+static int latin1_class[256];
+static int latin1_valid = 0;
+
+static const struct class_range default_ranges[] = {
+  { 0x2000, 0x200B, CLASS_SPACE }, /* spaces of various widths */
+  { 0x2010, 0x2027, 0 },           /* general punctuation */
+  { 0x202F, 0x202F, CLASS_SPACE },
+  { 0x2030, 0x205E, 0 },
+  { 0x205F, 0x205F, CLASS_SPACE },
+  { 0x2190, 0x21FF, 0 },           /* arrows */
+  { 0x2500, 0x259F, CLASS_FRAME }, /* box drawing, block elements */
+  { 0x25A0, 0x25FF, 0 },           /* geometric shapes */
+  { 0x3000, 0x3000, CLASS_SPACE }, /* ideographic space */
+  { 0x3001, 0x3003, 0 },           /* CJK punctuation */
+  { 0x3008, 0x3011, 0 },
+  { 0xFF01, 0xFF0F, 0 },           /* fullwidth punctuation */
+  { 0xFF1A, 0xFF20, 0 },
+};
+
+static int
+default_class(uint32_t c)
+{
+  size_t i;
+  if (c < 256)
+  {
+    if (c == ' ' || c == 0xA0 || c == 0)
+      return CLASS_SPACE;
+    return word_lut[c >> 5] & (1U << (c & 31)) ? CLASS_WORD : (int)c;
+  }
+  for (i = 0; i < sizeof(default_ranges)/sizeof(*default_ranges); i++)
+    if (c >= default_ranges[i].low && c <= default_ranges[i].high)
+      return default_ranges[i].cls ? default_ranges[i].cls : (int)c;
+  return CLASS_WORD;
+}
+
+static int
+char_class(uint32_t c)
+{
+  size_t i;
+  /* later ranges take precedence */
+  for (i = nranges; i-- > 0;)
+    if (c >= ranges[i].low && c <= ranges[i].high)
+      return ranges[i].cls;
+  return default_class(c);
+}
+
+static void
+update_latin1(void)
+{
+  uint32_t c;
+  for (c = 0; c < 256; c++)
+    latin1_class[c] = char_class(c);
+  latin1_valid = 1;
+}
+
+void
+words_set_lut(const uint32_t *lut)
+{
+  int i;
+  for (i = 0; i < 8; i++)
+    word_lut[i] = lut[i];
+  update_latin1();
+}
+
+/* Parse a list of LOW[-HIGH]:CLASS separated by commas, as in the
+   charClass resource of xterm. */
+
+int
+words_add_classes(const char *spec)
+{
+  while (*spec)
+  {
+    struct class_range r, *n;
+    char *end;
+    r.low = r.high = strtoul(spec, &end, 0);
+    if (end == spec)
+      return -1;
+    if (*end == '-')
+    {
+      spec = end + 1;
+      r.high = strtoul(spec, &end, 0);
+      if (end == spec || r.high < r.low)
+        return -1;
+    }
+    if (*end != ':')
+      return -1;
+    spec = end + 1;
+    r.cls = strtol(spec, &end, 0);
+    if (end == spec || (*end && *end != ','))
+      return -1;
+    spec = *end ? end + 1 : end;
+    n = realloc(ranges, (nranges + 1) * sizeof(*ranges));
+    if (!n)
+      return -1;
+    ranges = n;
+    ranges[nranges++] = r;
+  }
+  update_latin1();
+  return 0;
+}
+
+/* Classify a row of the screen. Most of the text on a console is
+   Latin-1, which is a table lookup. */
+
+static void
+classify(const uint32_t *text, int *cls, int width)
+{
+  int i;
+  if (!latin1_valid)
+    update_latin1();
+  for (i = 0; i < width; i++)
+    cls[i] = text[i] < 256 ? latin1_class[text[i]] : char_class(text[i]);
+}
+
+/* Return the first (dir < 0) or the last (dir > 0) column, counting from
+   0, of the word of the row that includes column x. */
+
+int
+word_boundary(const uint32_t *text, int width, int x, int dir)
+{
+  int cls[width];
+  int c;
+  classify(text, cls, width);
+  c = cls[x];
+  if (dir < 0)
+    while (x > 0 && cls[x-1] == c)
+      x--;
+  else
+    while (x < width-1 && cls[x+1] == c)
+      x++;
+  return x;
+}